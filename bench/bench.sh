@@ -0,0 +1,51 @@
+#!/bin/bash
+
+set -o errexit
+set -o nounset
+set -o pipefail
+
+# Run hexlog-bench for each process restriction, mode and chunk size.
+# Results are written to stdout as JSON lines.
+
+cd "$(dirname "$0")/.."
+
+case "$(uname -s)" in
+  Linux) DEFAULT_RESTRICT="seccomp rlimit null" ;;
+  *) DEFAULT_RESTRICT="rlimit null" ;;
+esac
+
+BENCH_RESTRICT="${BENCH_RESTRICT-$DEFAULT_RESTRICT}"
+BENCH_MODES="${BENCH_MODES-none in out inout rin rout rinout}"
+BENCH_CHUNKS="${BENCH_CHUNKS-1 16 256 4096 65536 1048576}"
+BENCH_BYTES="${BENCH_BYTES-67108864}"
+
+# throughput: at most BENCH_BYTES or 65536 writes
+bytes() {
+  local n=$(($1 * 65536))
+  echo $((n < BENCH_BYTES ? n : BENCH_BYTES))
+}
+
+# latency: 100 to 10000 round trips. p999 is written from 1000 round
+# trips.
+iterations() {
+  local n=$((BENCH_BYTES / $1))
+  n=$((n > 10000 ? 10000 : n))
+  echo $((n < 100 ? 100 : n))
+}
+
+for chunk in $BENCH_CHUNKS; do
+  bench/hexlog-bench - none "$chunk" "$(bytes "$chunk")" \
+    "$(iterations "$chunk")" |
+    sed 's/^{/{"restrict":"none",/'
+done
+
+for restrict in $BENCH_RESTRICT; do
+  make -s PROG="bench/hexlog.$restrict" RESTRICT_PROCESS="$restrict" >&2
+  for mode in $BENCH_MODES; do
+    for chunk in $BENCH_CHUNKS; do
+      bench/hexlog-bench "bench/hexlog.$restrict" "$mode" "$chunk" \
+        "$(bytes "$chunk")" "$(iterations "$chunk")" |
+        sed "s/^{/{\"restrict\":\"$restrict\",/"
+    done
+  done
+done
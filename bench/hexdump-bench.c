@@ -0,0 +1,362 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hexdump.h"
+
+/* Equivalence check and microbenchmark for the hexdump formatter.
+ *
+ *   hexdump-bench <rounds> <bytes> [<seed>]
+ *
+ * check: each formatter is run on <rounds> inputs of random size, content
+ * and label. The output must match the reference formatter byte for byte,
+ * both when formatted in one call and in pieces into a short buffer. The
+ * first difference is written to stderr and the exit status is 1.
+ *
+ * benchmark: each formatter formats at least <bytes> bytes for each input
+ * size. The result is written to stdout as JSON lines. The reference
+ * formatter writes to /dev/null: the cost includes stdio.
+ *
+ * Alternate formatters are added to the fmts table. */
+
+typedef size_t (*fmt_t)(char *dst, size_t dstlen, const char *label,
+                        size_t labellen, const void *data, size_t size,
+                        size_t *consumed);
+
+/* hexdump-portable.c */
+size_t hexdump_fmt_portable(char *dst, size_t dstlen, const char *label,
+                            size_t labellen, const void *data, size_t size,
+                            size_t *consumed);
+
+static const struct {
+  const char *name;
+  fmt_t fmt;
+} fmts[] = {
+    {"default", hexdump_fmt},
+    {"portable", hexdump_fmt_portable},
+};
+
+#define NFMTS (sizeof(fmts) / sizeof(fmts[0]))
+
+#define MAXSIZE 4096
+#define MAXLABEL 40
+#define LABEL " (0)"
+
+static const size_t sizes[] = {1, 7, 8, 9, 15, 16, 17, 64, 4096, 65536};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static int reference(FILE *stream, const char *label, const void *data,
+                     size_t size);
+static void check(size_t rounds);
+static void compare(const char *name, size_t round, const char *want,
+                    size_t wantlen, const char *got, size_t gotlen);
+static void bench(size_t bytes);
+static void result(const char *name, size_t size, size_t total,
+                   uint64_t elapsed);
+static int linelen(const char *p, size_t len);
+static size_t outsize(size_t size, size_t labellen);
+static uint64_t rnd(void);
+static uint64_t now_ns(void);
+static size_t arg(const char *s);
+
+int main(int argc, char *argv[]) {
+  size_t rounds;
+  size_t bytes;
+
+  if (argc != 3 && argc != 4) {
+    (void)fprintf(stderr, "usage: %s <rounds> <bytes> [<seed>]\n", argv[0]);
+    exit(2);
+  }
+
+  rounds = arg(argv[1]);
+  bytes = arg(argv[2]);
+  if (argc == 4)
+    seed = arg(argv[3]) | 1;
+
+  check(rounds);
+  bench(bytes);
+
+  return 0;
+}
+
+/* the original formatter */
+static int reference(FILE *stream, const char *label, const void *data,
+                     size_t size) {
+  const unsigned char *p = data;
+  unsigned char ascii[17];
+  size_t i, j;
+
+  ascii[16] = '\0';
+  for (i = 0; i < size; ++i) {
+    if (fprintf(stream, "%02X ", p[i]) < 0)
+      return -1;
+    if (p[i] >= ' ' && p[i] <= '~') {
+      ascii[i % 16] = p[i];
+    } else {
+      ascii[i % 16] = '.';
+    }
+    if ((i + 1) % 8 == 0 || i + 1 == size) {
+      if (fprintf(stream, " ") < 0)
+        return -1;
+      if ((i + 1) % 16 == 0) {
+        if (fprintf(stream, "|%s|%s\n", ascii, label) < 0)
+          return -1;
+      } else if (i + 1 == size) {
+        ascii[(i + 1) % 16] = '\0';
+        if ((i + 1) % 16 <= 8) {
+          if (fprintf(stream, " ") < 0)
+            return -1;
+        }
+        for (j = (i + 1) % 16; j < 16; ++j) {
+          if (fprintf(stream, "   ") < 0)
+            return -1;
+        }
+        if (fprintf(stream, "|%s|%s\n", ascii, label) < 0)
+          return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void check(size_t rounds) {
+  static const unsigned char edge[] = {0x00, 0x1f, 0x20, 0x7e,
+                                       0x7f, 0x80, 0xff, '|'};
+  unsigned char data[MAXSIZE];
+  char label[MAXLABEL + 1];
+  size_t labellen;
+  size_t size;
+  size_t osize;
+  size_t line;
+  char *want;
+  size_t wantlen;
+  FILE *stream;
+  char *out;
+  size_t dstlen;
+  size_t consumed;
+  size_t off;
+  size_t i;
+  size_t f;
+  size_t r;
+
+  out = malloc(outsize(MAXSIZE, MAXLABEL));
+  if (out == NULL)
+    err(111, "malloc");
+
+  for (r = 0; r < rounds; r++) {
+    /* mostly short inputs: the formats differ at the line boundaries */
+    size = rnd() % 4 == 0 ? rnd() % (MAXSIZE + 1) : rnd() % 49;
+
+    switch (rnd() % 3) {
+    case 0:
+      for (i = 0; i < size; i++)
+        data[i] = (unsigned char)rnd();
+      break;
+    case 1:
+      for (i = 0; i < size; i++)
+        data[i] = edge[rnd() % sizeof(edge)];
+      break;
+    default:
+      for (i = 0; i < size; i++)
+        data[i] = (unsigned char)(' ' + rnd() % 95);
+      break;
+    }
+
+    switch (rnd() % 3) {
+    case 0:
+      labellen = 0;
+      break;
+    case 1:
+      labellen = sizeof(LABEL) - 1;
+      (void)memcpy(label, LABEL, labellen);
+      break;
+    default:
+      labellen = rnd() % (MAXLABEL + 1);
+      for (i = 0; i < labellen; i++)
+        label[i] = (char)(' ' + rnd() % 95);
+      break;
+    }
+    label[labellen] = '\0';
+
+    stream = open_memstream(&want, &wantlen);
+    if (stream == NULL)
+      err(111, "open_memstream");
+    if (reference(stream, label, data, size) < 0 || fclose(stream) != 0)
+      err(111, "reference");
+
+    osize = outsize(size, labellen);
+    line = HEXDUMP_LINE_MAX + labellen + 1;
+
+    for (f = 0; f < NFMTS; f++) {
+      off = fmts[f].fmt(out, osize, label, labellen, data, size, &consumed);
+      if (consumed != size)
+        errx(1, "%s: round %zu: formatted %zu/%zu bytes", fmts[f].name, r,
+             consumed, size);
+      compare(fmts[f].name, r, want, wantlen, out, off);
+
+      /* the output buffer may fill in the middle of the input */
+      for (off = 0, i = 0; i < size; i += consumed) {
+        dstlen = line + rnd() % (4 * line);
+        if (dstlen > osize - off)
+          dstlen = osize - off;
+        off += fmts[f].fmt(out + off, dstlen, label, labellen, data + i,
+                           size - i, &consumed);
+        if (consumed == 0)
+          errx(1, "%s: round %zu: no progress at %zu/%zu bytes",
+               fmts[f].name, r, i, size);
+      }
+      compare(fmts[f].name, r, want, wantlen, out, off);
+    }
+
+    free(want);
+  }
+
+  free(out);
+}
+
+static void compare(const char *name, size_t round, const char *want,
+                    size_t wantlen, const char *got, size_t gotlen) {
+  size_t line = 0;
+  size_t start = 0;
+  size_t i;
+
+  for (i = 0; i < wantlen && i < gotlen && want[i] == got[i]; i++) {
+    if (want[i] == '\n') {
+      line++;
+      start = i + 1;
+    }
+  }
+
+  if (i == wantlen && i == gotlen)
+    return;
+
+  (void)fprintf(stderr,
+                "%s: round %zu: line %zu: column %zu: output differs\n"
+                "expected: %.*s\n"
+                "got:      %.*s\n",
+                name, round, line + 1, i - start + 1,
+                linelen(want + start, wantlen - start), want + start,
+                linelen(got + start, gotlen - start), got + start);
+  exit(1);
+}
+
+static void bench(size_t bytes) {
+  unsigned char *data;
+  char *out;
+  FILE *devnull;
+  size_t consumed;
+  size_t total;
+  size_t size;
+  uint64_t t0;
+  size_t f;
+  size_t s;
+  size_t i;
+
+  size = sizes[NSIZES - 1];
+
+  data = malloc(size);
+  out = malloc(outsize(size, sizeof(LABEL) - 1));
+  if (data == NULL || out == NULL)
+    err(111, "malloc");
+
+  for (i = 0; i < size; i++)
+    data[i] = (unsigned char)rnd();
+
+  devnull = fopen("/dev/null", "w");
+  if (devnull == NULL)
+    err(111, "fopen: /dev/null");
+
+  for (s = 0; s < NSIZES; s++) {
+    size = sizes[s];
+
+    t0 = now_ns();
+    for (total = 0; total < bytes || total == 0; total += size) {
+      if (reference(devnull, LABEL, data, size) < 0)
+        err(111, "reference");
+    }
+    if (fflush(devnull) != 0)
+      err(111, "fflush");
+    result("reference", size, total, now_ns() - t0);
+
+    for (f = 0; f < NFMTS; f++) {
+      t0 = now_ns();
+      for (total = 0; total < bytes || total == 0; total += size) {
+        (void)fmts[f].fmt(out, outsize(size, sizeof(LABEL) - 1), LABEL,
+                          sizeof(LABEL) - 1, data, size, &consumed);
+      }
+      result(fmts[f].name, size, total, now_ns() - t0);
+    }
+  }
+
+  (void)fclose(devnull);
+  free(out);
+  free(data);
+}
+
+static void result(const char *name, size_t size, size_t total,
+                   uint64_t elapsed) {
+  (void)printf("{\"formatter\":\"%s\",\"size\":%zu,\"bytes\":%zu,"
+               "\"ns_per_byte\":%.3f}\n",
+               name, size, total, (double)elapsed / (double)total);
+}
+
+static int linelen(const char *p, size_t len) {
+  const char *nl = memchr(p, '\n', len);
+
+  return (int)(nl == NULL ? len : (size_t)(nl - p));
+}
+
+/* output buffer holding all lines of size bytes */
+static size_t outsize(size_t size, size_t labellen) {
+  return (size / 16 + 1) * (HEXDUMP_LINE_MAX + labellen + 1);
+}
+
+/* xorshift64: the inputs are reproducible from the seed */
+static uint64_t rnd(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    err(111, "clock_gettime");
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static size_t arg(const char *s) {
+  char *end;
+  size_t n;
+
+  errno = 0;
+  n = (size_t)strtoull(s, &end, 10);
+  if (errno != 0 || *end != '\0')
+    errx(2, "invalid number: %s", s);
+
+  return n;
+}
@@ -0,0 +1,24 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+/* hexdump.c built without the SIMD kernels: the portable formatter is
+ * compared with the default build by hexdump-bench. */
+#define HEXDUMP_NO_SSE2
+#define hexdump_line hexdump_line_portable
+#define hexdump_fmt hexdump_fmt_portable
+#define hexdump_fmt_len hexdump_fmt_len_portable
+#define hexdump_fmt_squeeze hexdump_fmt_squeeze_portable
+#define hexdump_offset hexdump_offset_portable
+
+#include "../hexdump.c"
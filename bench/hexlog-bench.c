@@ -0,0 +1,315 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Load generator and sink for hexlog.
+ *
+ *   hexlog-bench <hexlog> <mode> <chunk> <bytes> <iterations>
+ *
+ * Runs "hexlog <mode> hexlog-bench echo", writes chunks to hexlog stdin
+ * and reads them back from hexlog stdout. The dump is written to
+ * /dev/null. If hexlog is "-", the echo process is run directly: the
+ * result is the baseline.
+ *
+ * throughput: bytes are written as fast as hexlog accepts them
+ * latency: a chunk is written after the previous chunk is read back. The
+ * latency is the time from the start of the write to the end of the read.
+ *
+ * The result is written to stdout as a JSON object. A percentile is
+ * written only if there are enough round trips to distinguish it from
+ * the maximum: p99 requires 100 iterations and p999 1000. */
+
+typedef struct {
+  pid_t pid;
+  int fdw; /* hexlog stdin */
+  int fdr; /* hexlog stdout */
+} proc_t;
+
+static char *buf;
+
+static int echo(void);
+static void start(proc_t *p, char *argv0, char *hexlog, char *mode);
+static void stop(proc_t *p);
+static double run(proc_t *p, size_t chunk, size_t count, int pingpong,
+                  uint64_t *lat);
+static uint64_t now_ns(void);
+static int cmp(const void *a, const void *b);
+static uint64_t pct(const uint64_t *lat, size_t n, double p);
+static size_t arg(const char *s);
+
+int main(int argc, char *argv[]) {
+  proc_t p;
+  size_t chunk;
+  size_t bytes;
+  size_t iter;
+  uint64_t *lat;
+  double elapsed;
+  size_t i;
+
+  if (argc == 2 && !strcmp(argv[1], "echo"))
+    return echo();
+
+  if (argc != 6) {
+    (void)fprintf(stderr,
+                  "usage: %s <hexlog|-> <mode> <chunk> <bytes> <iterations>\n",
+                  argv[0]);
+    exit(2);
+  }
+
+  chunk = arg(argv[3]);
+  bytes = arg(argv[4]);
+  iter = arg(argv[5]);
+
+  if (chunk == 0 || iter == 0)
+    errx(2, "invalid argument");
+
+  buf = malloc(chunk);
+  lat = calloc(iter, sizeof(uint64_t));
+  if (buf == NULL || lat == NULL)
+    err(111, "malloc");
+
+  /* printable and binary bytes */
+  for (i = 0; i < chunk; i++)
+    buf[i] = (char)(i * 7);
+
+  (void)signal(SIGPIPE, SIG_IGN);
+
+  start(&p, argv[0], argv[1], argv[2]);
+  elapsed = run(&p, chunk, bytes / chunk > 0 ? bytes / chunk : 1, 0, NULL);
+  stop(&p);
+
+  start(&p, argv[0], argv[1], argv[2]);
+  (void)run(&p, chunk, iter, 1, lat);
+  stop(&p);
+
+  qsort(lat, iter, sizeof(uint64_t), cmp);
+
+  bytes = (bytes / chunk > 0 ? bytes / chunk : 1) * chunk;
+
+  (void)printf("{\"mode\":\"%s\",\"chunk\":%zu,\"bytes\":%zu,"
+               "\"mbps\":%.2f,\"p50_us\":%.2f",
+               argv[1][0] == '-' ? "baseline" : argv[2], chunk, bytes,
+               (double)bytes / elapsed / 1e6, pct(lat, iter, 0.50) / 1e3);
+  if (iter >= 100)
+    (void)printf(",\"p99_us\":%.2f", pct(lat, iter, 0.99) / 1e3);
+  if (iter >= 1000)
+    (void)printf(",\"p999_us\":%.2f", pct(lat, iter, 0.999) / 1e3);
+  (void)printf("}\n");
+
+  free(lat);
+  free(buf);
+
+  return 0;
+}
+
+/* copy stdin to stdout */
+static int echo(void) {
+  static char data[1048576];
+  ssize_t n;
+  ssize_t off;
+  ssize_t w;
+
+  for (;;) {
+    n = read(STDIN_FILENO, data, sizeof(data));
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      err(111, "echo: read");
+    }
+    for (off = 0; off < n; off += w) {
+      w = write(STDOUT_FILENO, data + off, n - off);
+      if (w < 0) {
+        if (errno == EINTR) {
+          w = 0;
+          continue;
+        }
+        err(111, "echo: write");
+      }
+    }
+  }
+}
+
+static void start(proc_t *p, char *argv0, char *hexlog, char *mode) {
+  int in[2];
+  int out[2];
+  int fd;
+
+  if (pipe(in) < 0 || pipe(out) < 0)
+    err(111, "pipe");
+
+  p->pid = fork();
+  switch (p->pid) {
+  case -1:
+    err(111, "fork");
+  case 0:
+    fd = open("/dev/null", O_WRONLY);
+    if (fd < 0)
+      err(111, "open: /dev/null");
+    if (dup2(in[0], STDIN_FILENO) < 0 || dup2(out[1], STDOUT_FILENO) < 0 ||
+        dup2(fd, STDERR_FILENO) < 0)
+      err(111, "dup2");
+    (void)close(in[0]);
+    (void)close(in[1]);
+    (void)close(out[0]);
+    (void)close(out[1]);
+    (void)close(fd);
+    if (hexlog[0] == '-')
+      (void)execl(argv0, argv0, "echo", (char *)NULL);
+    else
+      (void)execl(hexlog, hexlog, mode, argv0, "echo", (char *)NULL);
+    err(127, "%s", hexlog);
+  default:
+    break;
+  }
+
+  (void)close(in[0]);
+  (void)close(out[1]);
+
+  p->fdw = in[1];
+  p->fdr = out[0];
+
+  if (fcntl(p->fdw, F_SETFL, O_NONBLOCK) < 0 ||
+      fcntl(p->fdr, F_SETFL, O_NONBLOCK) < 0)
+    err(111, "fcntl");
+}
+
+static void stop(proc_t *p) {
+  char data[4096];
+  int status;
+
+  (void)close(p->fdw);
+
+  (void)fcntl(p->fdr, F_SETFL, 0);
+  while (read(p->fdr, data, sizeof(data)) > 0)
+    ;
+  (void)close(p->fdr);
+
+  if (waitpid(p->pid, &status, 0) < 0)
+    err(111, "waitpid");
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    errx(111, "hexlog exited with status %d", status);
+}
+
+/* Write count chunks and read them back. Returns the elapsed time in
+ * seconds. */
+static double run(proc_t *p, size_t chunk, size_t count, int pingpong,
+                  uint64_t *lat) {
+  static char data[1048576];
+  struct pollfd fds[2];
+  size_t total = chunk * count;
+  size_t woff = 0; /* bytes written */
+  size_t roff = 0; /* bytes read */
+  uint64_t t0 = now_ns();
+  uint64_t ts = t0;
+  ssize_t n;
+  size_t len;
+
+  while (roff < total) {
+    fds[0].fd = p->fdw;
+    fds[0].events = POLLOUT;
+    fds[1].fd = p->fdr;
+    fds[1].events = POLLIN;
+
+    /* ping-pong: wait for the previous chunk */
+    if (woff == total || (pingpong && woff > roff && woff % chunk == 0))
+      fds[0].fd = -1;
+
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      err(111, "poll");
+    }
+
+    if (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)) {
+      if (pingpong && woff % chunk == 0)
+        ts = now_ns();
+
+      len = chunk - woff % chunk;
+      n = write(p->fdw, buf + woff % chunk, len);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        err(111, "write");
+      if (n > 0)
+        woff += (size_t)n;
+    }
+
+    if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+      len = total - roff < sizeof(data) ? total - roff : sizeof(data);
+      n = read(p->fdr, data, len);
+      if (n == 0)
+        errx(111, "unexpected EOF after %zu bytes", roff);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        err(111, "read");
+      if (n > 0) {
+        roff += (size_t)n;
+        if (pingpong && roff == woff && roff % chunk == 0)
+          lat[roff / chunk - 1] = now_ns() - ts;
+      }
+    }
+  }
+
+  return (double)(now_ns() - t0) / 1e9;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    err(111, "clock_gettime");
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* nearest rank: the smallest sample with at least p * n samples less
+ * than or equal to it */
+static uint64_t pct(const uint64_t *lat, size_t n, double p) {
+  size_t i = (size_t)ceil(p * (double)n);
+
+  return lat[i > 0 ? i - 1 : 0];
+}
+
+static size_t arg(const char *s) {
+  char *end;
+  size_t n;
+
+  errno = 0;
+  n = (size_t)strtoull(s, &end, 10);
+  if (errno != 0 || *end != '\0')
+    errx(2, "invalid number: %s", s);
+
+  return n;
+}
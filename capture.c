@@ -0,0 +1,70 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <time.h>
+
+#include "capture.h"
+
+static void put64(unsigned char *p, uint64_t v);
+static void put32(unsigned char *p, uint32_t v);
+static uint64_t get64(const unsigned char *p);
+static uint32_t get32(const unsigned char *p);
+
+void capture_encode(unsigned char *dst, const capture_hdr_t *hdr) {
+  put64(dst, hdr->ts);
+  put64(dst + 8, hdr->seq);
+  put32(dst + 16, hdr->len);
+  dst[20] = hdr->stream;
+  dst[21] = hdr->type;
+  dst[22] = 0;
+  dst[23] = 0;
+}
+
+void capture_decode(capture_hdr_t *hdr, const unsigned char *src) {
+  hdr->ts = get64(src);
+  hdr->seq = get64(src + 8);
+  hdr->len = get32(src + 16);
+  hdr->stream = src[20];
+  hdr->type = src[21];
+}
+
+uint64_t capture_now(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+  put32(p, (uint32_t)v);
+  put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+static uint64_t get64(const unsigned char *p) {
+  return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint32_t get32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary capture format
+ *
+ * A capture starts with CAPTURE_MAGIC followed by records. Each record
+ * is a CAPTURE_HDR_SIZE byte header followed by len bytes of data. The
+ * header fields are little endian:
+ *
+ *   0  ts      u64  CLOCK_MONOTONIC time of the dump (ns)
+ *   8  seq     u64  record sequence number, ordered across streams
+ *   16 len     u32  CAPTURE_DATA: size of the data
+ *                   CAPTURE_SKIPPED: number of bytes dropped (no data)
+ *   20 stream  u8   stream id: 0 (stdin), 1 (stdout)
+ *   21 type    u8
+ *   22         u16  reserved
+ */
+#define CAPTURE_MAGIC "HEXLOG\0\1"
+#define CAPTURE_MAGIC_SIZE 8
+#define CAPTURE_HDR_SIZE 24
+
+enum {
+  CAPTURE_DATA = 0,
+  CAPTURE_SKIPPED = 1,
+};
+
+typedef struct {
+  uint64_t ts;
+  uint64_t seq;
+  uint32_t len;
+  uint8_t stream;
+  uint8_t type;
+} capture_hdr_t;
+
+void capture_encode(unsigned char *dst, const capture_hdr_t *hdr);
+void capture_decode(capture_hdr_t *hdr, const unsigned char *src);
+uint64_t capture_now(void);
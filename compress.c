@@ -0,0 +1,172 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "compress.h"
+#ifdef HAVE_ZLIB
+#include <errno.h>
+#include <stdlib.h>
+
+#include <zlib.h>
+
+/* The output is a gzip stream. A sync flush point is written after
+ * every block bytes of input: a reader can decompress all data up to the
+ * last flush point if the stream is truncated. */
+struct compress {
+  z_stream z;
+  size_t block;
+  size_t pending; /* input since the last flush point */
+  char *buf;
+  size_t size;
+};
+
+static int compress_run(compress_t *c, int flush, const char **out,
+                        size_t *outlen);
+
+compress_t *compress_init(int level, size_t block) {
+  compress_t *c;
+
+  c = calloc(1, sizeof(compress_t));
+  if (c == NULL)
+    return NULL;
+
+  c->block = block;
+  c->size = 65536;
+  c->buf = malloc(c->size);
+  if (c->buf == NULL) {
+    free(c);
+    return NULL;
+  }
+
+  /* windowBits + 16: gzip header */
+  if (deflateInit2(&c->z, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(c->buf);
+    free(c);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return c;
+}
+
+/* Compress data. The output is valid until the next call and may be
+ * empty. */
+int compress_data(compress_t *c, const void *data, size_t len, int sync,
+                  const char **out, size_t *outlen) {
+  c->z.next_in = (Bytef *)data;
+  c->z.avail_in = (uInt)len;
+  c->pending += len;
+
+  if (c->pending >= c->block)
+    sync = 1;
+
+  if (sync)
+    c->pending = 0;
+
+  return compress_run(c, sync ? Z_SYNC_FLUSH : Z_NO_FLUSH, out, outlen);
+}
+
+/* Returns the end of the gzip stream. */
+int compress_finish(compress_t *c, const char **out, size_t *outlen) {
+  c->z.next_in = NULL;
+  c->z.avail_in = 0;
+
+  return compress_run(c, Z_FINISH, out, outlen);
+}
+
+/* Start a new gzip stream after compress_finish(). */
+int compress_reset(compress_t *c) {
+  c->pending = 0;
+
+  if (deflateReset(&c->z) != Z_OK) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+void compress_free(compress_t *c) {
+  (void)deflateEnd(&c->z);
+  free(c->buf);
+  free(c);
+}
+
+static int compress_run(compress_t *c, int flush, const char **out,
+                        size_t *outlen) {
+  size_t off = 0;
+  char *buf;
+  int rv;
+
+  for (;;) {
+    c->z.next_out = (Bytef *)c->buf + off;
+    c->z.avail_out = (uInt)(c->size - off);
+
+    rv = deflate(&c->z, flush);
+    if (rv == Z_STREAM_ERROR) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    off = c->size - c->z.avail_out;
+
+    /* all input consumed and the output was not truncated */
+    if (c->z.avail_in == 0 && c->z.avail_out > 0)
+      break;
+
+    buf = realloc(c->buf, c->size * 2);
+    if (buf == NULL)
+      return -1;
+
+    c->buf = buf;
+    c->size *= 2;
+  }
+
+  *out = c->buf;
+  *outlen = off;
+
+  return 0;
+}
+#else
+compress_t *compress_init(int level, size_t block) {
+  (void)level;
+  (void)block;
+  return NULL;
+}
+
+int compress_data(compress_t *c, const void *data, size_t len, int sync,
+                  const char **out, size_t *outlen) {
+  (void)c;
+  (void)data;
+  (void)len;
+  (void)sync;
+  (void)out;
+  (void)outlen;
+  return -1;
+}
+
+int compress_finish(compress_t *c, const char **out, size_t *outlen) {
+  (void)c;
+  (void)out;
+  (void)outlen;
+  return -1;
+}
+
+int compress_reset(compress_t *c) {
+  (void)c;
+  return -1;
+}
+
+void compress_free(compress_t *c) { (void)c; }
+#endif
@@ -0,0 +1,131 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define DIGEST_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define DIGEST_ARMV8
+#endif
+
+#include "digest.h"
+
+/* CRC-32C (Castagnoli): the checksum computed by the SSE4.2 crc32 and
+ * ARMv8 crc32c instructions. The instructions are used if the CPU
+ * supports them, otherwise the table driven version is used.
+ *
+ * The crc argument is the checksum of the preceding data (0 for none):
+ *
+ *   crc = digest_crc32c(0, buf1, len1);
+ *   crc = digest_crc32c(crc, buf2, len2); */
+
+#define POLY 0x82f63b78 /* reversed */
+
+static uint32_t table[8][256];
+
+static uint32_t (*crc32c)(uint32_t crc, const unsigned char *p, size_t n);
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n);
+#if defined(DIGEST_SSE42) || defined(DIGEST_ARMV8)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n);
+#endif
+
+void digest_init(void) {
+  uint32_t crc;
+  size_t i, j;
+
+  for (i = 0; i < 256; i++) {
+    crc = (uint32_t)i;
+    for (j = 0; j < 8; j++)
+      crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+    table[0][i] = crc;
+  }
+
+  for (i = 0; i < 256; i++) {
+    for (j = 1; j < 8; j++)
+      table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+  }
+
+  crc32c = crc32c_sw;
+
+#if defined(DIGEST_SSE42)
+  if (__builtin_cpu_supports("sse4.2"))
+    crc32c = crc32c_hw;
+#elif defined(DIGEST_ARMV8)
+  crc32c = crc32c_hw;
+#endif
+}
+
+uint32_t digest_crc32c(uint32_t crc, const void *data, size_t size) {
+  return ~crc32c(~crc, data, size);
+}
+
+/* slicing-by-8: 8 bytes per iteration */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+  uint32_t lo;
+  uint32_t hi;
+
+  for (; n >= 8; p += 8, n -= 8) {
+    lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+                (uint32_t)p[3] << 24);
+    hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 |
+         (uint32_t)p[7] << 24;
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+          table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+          table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+  }
+
+  for (; n > 0; p++, n--)
+    crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+
+  return crc;
+}
+
+#if defined(DIGEST_SSE42)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+  uint64_t crc64 = crc;
+  uint64_t v;
+
+  for (; n >= 8; p += 8, n -= 8) {
+    (void)memcpy(&v, p, sizeof(v));
+    crc64 = _mm_crc32_u64(crc64, v);
+  }
+
+  crc = (uint32_t)crc64;
+
+  for (; n > 0; p++, n--)
+    crc = _mm_crc32_u8(crc, *p);
+
+  return crc;
+}
+#elif defined(DIGEST_ARMV8)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+  uint64_t v;
+
+  for (; n >= 8; p += 8, n -= 8) {
+    (void)memcpy(&v, p, sizeof(v));
+    crc = __crc32cd(crc, v);
+  }
+
+  for (; n > 0; p++, n--)
+    crc = __crc32cb(crc, *p);
+
+  return crc;
+}
+#endif
@@ -0,0 +1,30 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* HEXLOG_DIGEST: digest of a stream */
+typedef struct {
+  uint64_t bytes;
+  uint32_t crc;
+  uint64_t seq;        /* HEXLOG_DIGEST_MESSAGE: messages digested */
+  uint64_t mbytes;     /* current message */
+  uint32_t mcrc;
+  unsigned int mstate; /* message delimiter matcher state */
+  int done;            /* final digest written */
+} digest_t;
+
+void digest_init(void);
+uint32_t digest_crc32c(uint32_t crc, const void *data, size_t size);
@@ -0,0 +1,31 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+
+/* Event loop backends: a slot holds a file descriptor and the poll(2)
+ * events of interest. The interest set is updated with event_set() before
+ * each call to event_wait(). */
+typedef struct event event_t;
+
+event_t *event_init(size_t nslot);
+int event_set(event_t *ev, size_t slot, int fd, short events);
+int event_wait(event_t *ev, int timeout);
+short event_revents(event_t *ev, size_t slot);
+void event_free(event_t *ev);
+
+/* Signals are returned by reading a file descriptor. */
+int event_signal_init(const int *sigs, size_t nsig);
+int event_signal_read(int fd);
+int event_signal_child(void);
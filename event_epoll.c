@@ -0,0 +1,253 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "event.h"
+#ifdef EVENT_epoll
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+/* Each slot registers a duplicate of the file descriptor: the slot owns
+ * the registration and removes it when the descriptor changes, even if
+ * the original was closed or is used by another slot.
+ *
+ * Regular files do not support epoll(7) and, as with poll(2), are always
+ * ready. */
+typedef struct {
+  int fd;
+  int dupfd;
+  short events;
+  short revents;
+  int always; /* regular file: always ready */
+} slot_t;
+
+struct event {
+  int epfd;
+  slot_t *slot;
+  size_t nslot;
+  struct epoll_event *ready;
+};
+
+static sigset_t sigmask_orig;
+
+static int slot_add(event_t *ev, size_t n, int fd, short events);
+static void slot_del(event_t *ev, size_t n);
+static uint32_t to_epoll(short events);
+static short from_epoll(uint32_t events);
+
+event_t *event_init(size_t nslot) {
+  event_t *ev;
+  size_t i;
+
+  ev = calloc(1, sizeof(event_t));
+  if (ev == NULL)
+    return NULL;
+
+  ev->slot = calloc(nslot, sizeof(slot_t));
+  ev->ready = calloc(nslot, sizeof(struct epoll_event));
+  if (ev->slot == NULL || ev->ready == NULL)
+    goto ERR;
+
+  for (i = 0; i < nslot; i++) {
+    ev->slot[i].fd = -1;
+    ev->slot[i].dupfd = -1;
+  }
+
+  ev->nslot = nslot;
+
+  ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ev->epfd < 0)
+    goto ERR;
+
+  return ev;
+
+ERR:
+  free(ev->slot);
+  free(ev->ready);
+  free(ev);
+  return NULL;
+}
+
+int event_set(event_t *ev, size_t n, int fd, short events) {
+  slot_t *sl = &ev->slot[n];
+  struct epoll_event e = {0};
+
+  if (sl->fd == fd && (fd == -1 || sl->events == events))
+    return 0;
+
+  if (sl->fd != fd) {
+    slot_del(ev, n);
+    return fd == -1 ? 0 : slot_add(ev, n, fd, events);
+  }
+
+  sl->events = events;
+
+  if (sl->always)
+    return 0;
+
+  e.events = to_epoll(events);
+  e.data.u32 = (uint32_t)n;
+
+  return epoll_ctl(ev->epfd, EPOLL_CTL_MOD, sl->dupfd, &e);
+}
+
+int event_wait(event_t *ev, int timeout) {
+  slot_t *sl;
+  size_t i;
+  int always = 0;
+  int n;
+
+  for (i = 0; i < ev->nslot; i++) {
+    sl = &ev->slot[i];
+    sl->revents = 0;
+    if (sl->always && sl->events) {
+      sl->revents = sl->events & (POLLIN | POLLOUT);
+      always++;
+    }
+  }
+
+  n = epoll_wait(ev->epfd, ev->ready, (int)ev->nslot,
+                 always > 0 ? 0 : timeout);
+  if (n < 0)
+    return always > 0 && errno == EINTR ? always : -1;
+
+  for (i = 0; i < (size_t)n; i++) {
+    sl = &ev->slot[ev->ready[i].data.u32];
+    sl->revents = from_epoll(ev->ready[i].events);
+  }
+
+  return n + always;
+}
+
+short event_revents(event_t *ev, size_t n) { return ev->slot[n].revents; }
+
+void event_free(event_t *ev) {
+  size_t i;
+
+  for (i = 0; i < ev->nslot; i++)
+    slot_del(ev, i);
+
+  (void)close(ev->epfd);
+  free(ev->slot);
+  free(ev->ready);
+  free(ev);
+}
+
+static int slot_add(event_t *ev, size_t n, int fd, short events) {
+  slot_t *sl = &ev->slot[n];
+  struct epoll_event e = {0};
+
+  sl->fd = fd;
+  sl->events = events;
+  sl->revents = 0;
+
+  sl->dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (sl->dupfd < 0)
+    return -1;
+
+  e.events = to_epoll(events);
+  e.data.u32 = (uint32_t)n;
+
+  if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, sl->dupfd, &e) < 0) {
+    if (errno != EPERM)
+      return -1;
+    sl->always = 1;
+  }
+
+  return 0;
+}
+
+static void slot_del(event_t *ev, size_t n) {
+  slot_t *sl = &ev->slot[n];
+
+  if (sl->dupfd != -1) {
+    if (!sl->always)
+      (void)epoll_ctl(ev->epfd, EPOLL_CTL_DEL, sl->dupfd, NULL);
+    (void)close(sl->dupfd);
+  }
+
+  sl->fd = -1;
+  sl->dupfd = -1;
+  sl->events = 0;
+  sl->revents = 0;
+  sl->always = 0;
+}
+
+static uint32_t to_epoll(short events) {
+  uint32_t e = 0;
+
+  if (events & POLLIN)
+    e |= EPOLLIN;
+  if (events & POLLOUT)
+    e |= EPOLLOUT;
+
+  return e;
+}
+
+static short from_epoll(uint32_t events) {
+  short e = 0;
+
+  if (events & EPOLLIN)
+    e |= POLLIN;
+  if (events & EPOLLOUT)
+    e |= POLLOUT;
+  if (events & EPOLLERR)
+    e |= POLLERR;
+  if (events & EPOLLHUP)
+    e |= POLLHUP;
+
+  return e;
+}
+
+/* Signals are blocked and read from a signalfd(2). The mask is inherited
+ * across fork(2): the child restores the original mask. */
+int event_signal_init(const int *sigs, size_t nsig) {
+  sigset_t mask;
+  size_t i;
+
+  (void)sigemptyset(&mask);
+
+  for (i = 0; i < nsig; i++) {
+    if (sigaddset(&mask, sigs[i]) < 0)
+      return -1;
+  }
+
+  if (sigprocmask(SIG_BLOCK, &mask, &sigmask_orig) < 0)
+    return -1;
+
+  return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/* Returns the signal number or -1 on error. */
+int event_signal_read(int fd) {
+  struct signalfd_siginfo si;
+  ssize_t n;
+
+  n = read(fd, &si, sizeof(si));
+  if (n != sizeof(si))
+    return -1;
+
+  return (int)si.ssi_signo;
+}
+
+int event_signal_child(void) {
+  return sigprocmask(SIG_SETMASK, &sigmask_orig, NULL);
+}
+#endif
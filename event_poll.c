@@ -0,0 +1,118 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "event.h"
+#ifdef EVENT_poll
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct event {
+  struct pollfd *fds;
+  size_t nfds;
+};
+
+/* sigfd[0]: written by the signal handler
+ * sigfd[1]: read by the event loop */
+static int sigfd[2] = {-1, -1};
+
+static void sighandler(int sig);
+
+event_t *event_init(size_t nslot) {
+  event_t *ev;
+  size_t i;
+
+  ev = calloc(1, sizeof(event_t));
+  if (ev == NULL)
+    return NULL;
+
+  ev->fds = calloc(nslot, sizeof(struct pollfd));
+  if (ev->fds == NULL) {
+    free(ev);
+    return NULL;
+  }
+
+  for (i = 0; i < nslot; i++)
+    ev->fds[i].fd = -1;
+
+  ev->nfds = nslot;
+
+  return ev;
+}
+
+int event_set(event_t *ev, size_t slot, int fd, short events) {
+  ev->fds[slot].fd = fd;
+  ev->fds[slot].events = events;
+  return 0;
+}
+
+int event_wait(event_t *ev, int timeout) {
+  return poll(ev->fds, ev->nfds, timeout);
+}
+
+short event_revents(event_t *ev, size_t slot) {
+  return ev->fds[slot].fd == -1 ? 0 : ev->fds[slot].revents;
+}
+
+void event_free(event_t *ev) {
+  free(ev->fds);
+  free(ev);
+}
+
+static void sighandler(int sig) {
+  if (write(sigfd[0], &sig, sizeof(sig)) < 0)
+    (void)close(sigfd[0]);
+}
+
+int event_signal_init(const int *sigs, size_t nsig) {
+  struct sigaction act = {0};
+  size_t i;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sigfd) < 0)
+    return -1;
+
+  act.sa_handler = sighandler;
+  (void)sigfillset(&act.sa_mask);
+
+  for (i = 0; i < nsig; i++) {
+    if (sigaction(sigs[i], &act, NULL) < 0)
+      return -1;
+  }
+
+  return sigfd[1];
+}
+
+/* Returns the signal number or -1 on error. */
+int event_signal_read(int fd) {
+  ssize_t n;
+  int sig;
+
+  n = read(fd, &sig, sizeof(sig));
+  if (n != sizeof(sig))
+    return -1;
+
+  return sig;
+}
+
+/* The child process does not use the signal socket. */
+int event_signal_child(void) {
+  if (close(sigfd[0]) < 0 || close(sigfd[1]) < 0)
+    return -1;
+
+  return 0;
+}
+#endif
@@ -0,0 +1,240 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <string.h>
+
+/* HEXDUMP_NO_SSE2: build the portable formatter only */
+#if defined(__SSE2__) && !defined(HEXDUMP_NO_SSE2)
+#define HEXDUMP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "hexdump.h"
+
+/* Line layout (the format originates from
+ * https://gist.github.com/ccbrown/9722406):
+ *
+ *   00 01 02 03 04 05 06 07  08 09 0A 0B 0C 0D 0E 0F  |0123456789abcdef|label
+ *
+ * The hex columns are always HEXDUMP_HEX_WIDTH characters wide: short
+ * lines are padded with spaces.
+ */
+
+#define HEXROW(_h)                                                             \
+  _h "0" _h "1" _h "2" _h "3" _h "4" _h "5" _h "6" _h "7" _h "8" _h "9" _h "A" \
+      _h "B" _h "C" _h "D" _h "E" _h "F"
+
+static const char hexpair[] =
+    HEXROW("0") HEXROW("1") HEXROW("2") HEXROW("3") HEXROW("4") HEXROW("5")
+        HEXROW("6") HEXROW("7") HEXROW("8") HEXROW("9") HEXROW("A")
+            HEXROW("B") HEXROW("C") HEXROW("D") HEXROW("E") HEXROW("F");
+
+#define DOT16 "................"
+
+static const char printable[] =
+    DOT16 DOT16 " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ["
+                "\\]^_`abcdefghijklmnopqrstuvwxyz{|}~." DOT16 DOT16 DOT16 DOT16
+                    DOT16 DOT16 DOT16 DOT16;
+
+static inline size_t hexcol(size_t i) { return i * 3 + (i > 7); }
+
+static inline int line_equal(const unsigned char *a, const unsigned char *b) {
+#ifdef HEXDUMP_SSE2
+  return _mm_movemask_epi8(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+                            _mm_loadu_si128((const __m128i *)b))) == 0xffff;
+#else
+  return memcmp(a, b, 16) == 0;
+#endif
+}
+
+#ifdef HEXDUMP_SSE2
+static void hexdump_line16(char *dst, const unsigned char *data) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i alpha = _mm_set1_epi8('A' - '0' - 10);
+  __m128i v;
+  __m128i hi;
+  __m128i lo;
+  __m128i mask;
+  char pairs[32];
+  size_t i;
+
+  v = _mm_loadu_si128((const __m128i *)data);
+
+  hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+  lo = _mm_and_si128(v, nibble);
+
+  hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+                    _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+  lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+                    _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+  _mm_storeu_si128((__m128i *)pairs, _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128((__m128i *)(pairs + 16), _mm_unpackhi_epi8(hi, lo));
+
+  (void)memset(dst, ' ', HEXDUMP_HEX_WIDTH);
+  for (i = 0; i < 16; i++)
+    (void)memcpy(dst + hexcol(i), pairs + i * 2, 2);
+
+  /* signed compare: bytes >= 0x80 are negative and fail the lower bound */
+  mask = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+
+  dst[HEXDUMP_HEX_WIDTH] = '|';
+  _mm_storeu_si128((__m128i *)(dst + HEXDUMP_HEX_WIDTH + 1),
+                   _mm_or_si128(_mm_and_si128(mask, v),
+                                _mm_andnot_si128(mask, _mm_set1_epi8('.'))));
+  dst[HEXDUMP_HEX_WIDTH + 17] = '|';
+}
+#endif
+
+/* Format up to 16 bytes as a single line without the label or newline.
+ * Returns the number of characters written (at most HEXDUMP_LINE_MAX). */
+size_t hexdump_line(char *dst, const unsigned char *data, size_t n) {
+  size_t i;
+
+#ifdef HEXDUMP_SSE2
+  if (n == 16) {
+    hexdump_line16(dst, data);
+    return HEXDUMP_LINE_MAX;
+  }
+#endif
+
+  (void)memset(dst, ' ', HEXDUMP_HEX_WIDTH);
+
+  dst[HEXDUMP_HEX_WIDTH] = '|';
+  for (i = 0; i < n; i++) {
+    (void)memcpy(dst + hexcol(i), hexpair + data[i] * 2, 2);
+    dst[HEXDUMP_HEX_WIDTH + 1 + i] = printable[data[i]];
+  }
+  dst[HEXDUMP_HEX_WIDTH + 1 + n] = '|';
+
+  return HEXDUMP_HEX_WIDTH + 2 + n;
+}
+
+/* Format as many complete lines of data as fit in dst. The number of
+ * input bytes formatted is returned in consumed. Returns the number of
+ * characters written. */
+size_t hexdump_fmt(char *dst, size_t dstlen, const char *label,
+                   size_t labellen, const void *data, size_t size,
+                   size_t *consumed) {
+  const unsigned char *p = data;
+  size_t off = 0;
+  size_t i = 0;
+  size_t n;
+
+  while (i < size) {
+    n = size - i < 16 ? size - i : 16;
+
+    if (dstlen - off < HEXDUMP_HEX_WIDTH + 2 + n + labellen + 1)
+      break;
+
+    off += hexdump_line(dst + off, p + i, n);
+    (void)memcpy(dst + off, label, labellen);
+    off += labellen;
+    dst[off++] = '\n';
+
+    i += n;
+  }
+
+  *consumed = i;
+  return off;
+}
+
+/* Returns the number of characters written by hexdump_fmt() for size
+ * bytes: all lines except the last are complete. */
+size_t hexdump_fmt_len(size_t size, size_t labellen) {
+  size_t len = size / 16 * (HEXDUMP_LINE_MAX + labellen + 1);
+
+  if (size % 16 != 0)
+    len += HEXDUMP_HEX_WIDTH + 2 + size % 16 + labellen + 1;
+
+  return len;
+}
+
+/* Format the offset column: at least 8 hex digits followed by 2 spaces.
+ * Returns the number of characters written (at most
+ * HEXDUMP_OFFSET_MAX). */
+size_t hexdump_offset(char *dst, size_t offset) {
+  size_t digits = 8;
+  size_t i;
+
+  while (digits < 16 && offset >> (digits * 4) != 0)
+    digits++;
+
+  for (i = digits; i > 0; i--) {
+    dst[i - 1] = hexpair[(offset & 0xf) * 2 + 1];
+    offset >>= 4;
+  }
+
+  dst[digits] = ' ';
+  dst[digits + 1] = ' ';
+
+  return digits + 2;
+}
+
+/* hexdump -C style: lines are prefixed with the offset and a run of
+ * complete lines identical to the previous line is written as a single
+ * "*" line. The state is kept in sq across calls. Returns the number of
+ * characters written. */
+size_t hexdump_fmt_squeeze(char *dst, size_t dstlen, const char *label,
+                           size_t labellen, const void *data, size_t size,
+                           size_t *consumed, hexdump_squeeze_t *sq) {
+  const unsigned char *p = data;
+  size_t off = 0;
+  size_t i = 0;
+  size_t n;
+
+  while (i < size) {
+    n = size - i < 16 ? size - i : 16;
+
+    if (n == 16 && sq->valid && line_equal(p + i, sq->last)) {
+      if (!sq->squeezed) {
+        if (dstlen - off < 1 + labellen + 1)
+          break;
+        dst[off++] = '*';
+        (void)memcpy(dst + off, label, labellen);
+        off += labellen;
+        dst[off++] = '\n';
+        sq->squeezed = 1;
+      }
+      sq->offset += 16;
+      i += 16;
+      continue;
+    }
+
+    if (dstlen - off <
+        HEXDUMP_OFFSET_MAX + HEXDUMP_HEX_WIDTH + 2 + n + labellen + 1)
+      break;
+
+    off += hexdump_offset(dst + off, sq->offset);
+    off += hexdump_line(dst + off, p + i, n);
+    (void)memcpy(dst + off, label, labellen);
+    off += labellen;
+    dst[off++] = '\n';
+
+    sq->valid = n == 16;
+    if (sq->valid)
+      (void)memcpy(sq->last, p + i, 16);
+    sq->squeezed = 0;
+    sq->offset += n;
+
+    i += n;
+  }
+
+  *consumed = i;
+  return off;
+}
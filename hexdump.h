@@ -0,0 +1,42 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+
+/* width of the hex columns, including the separating spaces */
+#define HEXDUMP_HEX_WIDTH 50
+
+/* longest line excluding the label and newline: hex columns + |ascii| */
+#define HEXDUMP_LINE_MAX (HEXDUMP_HEX_WIDTH + 1 + 16 + 1)
+
+/* longest offset column: 64-bit offset and separating spaces */
+#define HEXDUMP_OFFSET_MAX (16 + 2)
+
+/* squeezing: runs of identical lines are written as "*" */
+typedef struct {
+  size_t offset;          /* offset of the next line */
+  unsigned char last[16]; /* previous complete line */
+  int valid;              /* last holds a line */
+  int squeezed;           /* "*" was written for the run */
+} hexdump_squeeze_t;
+
+size_t hexdump_line(char *dst, const unsigned char *data, size_t n);
+size_t hexdump_offset(char *dst, size_t offset);
+size_t hexdump_fmt(char *dst, size_t dstlen, const char *label,
+                   size_t labellen, const void *data, size_t size,
+                   size_t *consumed);
+size_t hexdump_fmt_len(size_t size, size_t labellen);
+size_t hexdump_fmt_squeeze(char *dst, size_t dstlen, const char *label,
+                           size_t labellen, const void *data, size_t size,
+                           size_t *consumed, hexdump_squeeze_t *sq);
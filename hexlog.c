@@ -12,8 +12,14 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#ifdef __linux__
+#define _GNU_SOURCE
+#define HAVE_SPLICE
+#endif
+
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
@@ -22,87 +28,387 @@
 
 #include <signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
+#include <inttypes.h>
+#include <limits.h>
 #include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 #ifdef RESTRICT_PROCESS_capsicum
 #include <sys/procdesc.h>
 #endif
 
+#include "capture.h"
+#include "compress.h"
+#include "digest.h"
+#include "event.h"
+#include "hexdump.h"
+#include "match.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "queue.h"
 #include "restrict_process.h"
+#include "rotate.h"
+#include "sample.h"
+#include "stats.h"
 #include "waitfor.h"
 
 #define HEXLOG_VERSION "1.0.0"
 
 #define COUNT(_array) (sizeof(_array) / sizeof(_array[0]))
 
+/* initial size of a read(2) from a stream */
+#define HEXLOG_READ_SIZE 4096
+
+/* HEXLOG_BUFSIZE: default maximum size of a read(2) from a stream */
+#define HEXLOG_BUFSIZE 65536
+
+/* minimum number of bytes queued for a stream destination */
+#define HEXLOG_PENDING_SIZE 65536
+
+/* largest dump record: a read and the remainder of the previous line */
+#define HEXLOG_RECORD_SIZE(_s) ((_s)->bufsize + 16)
+
+/* start of the partial line: the line is stored before the read buffer */
+#define HEXLOG_LINE(_h) ((_h)->buf + 16 - (_h)->off)
+
+/* HEXLOG_OUTPUT_SIZE: default bytes of dump buffered before writing */
+#define HEXLOG_OUTPUT_SIZE 65536
+
+/* default size of the dump queue of a stream */
+#define HEXLOG_QUEUE_SIZE 1048576
+
+/* maximum number of bytes moved by a call to splice(2)/tee(2) */
+#define HEXLOG_SPLICE_SIZE 65536
+
+/* HEXLOG_COMPRESS_BLOCK: default bytes of dump between sync flushes */
+#define HEXLOG_COMPRESS_BLOCK 65536
+
+/* capacity of the child stdio pipes: at least the size of the default
+ * socketpair(2) buffers previously used */
+#define HEXLOG_PIPE_SIZE 262144
+
+/* HEXLOG_FORMAT_WORKERS: bytes of a record formatted by a worker: records
+ * of at least 2 slices are split */
+#define HEXLOG_SLICE_SIZE 16384
+
+/* maximum number of streams: stdin, stdout and HEXLOG_FDS */
+#define HEXLOG_STREAM_MAX 16
+
+/* HEXLOG_SINKS: maximum number of additional dump outputs of a stream */
+#define HEXLOG_FANOUT_MAX 4
+
+/* maximum number of dump outputs */
+#define HEXLOG_SINK_MAX (HEXLOG_STREAM_MAX * (1 + HEXLOG_FANOUT_MAX))
+
 enum {
   NONE = 0,
   IN = 1,
   OUT = 2,
 };
 
+/* dump format */
+enum {
+  FMT_HEX = 0,
+  FMT_RAW = 1,
+  FMT_CAPTURE = 2,
+};
+
+/* dump output: streams writing to the same file descriptor share a
+ * sink */
+typedef struct {
+  int fd;
+  int nonblock; /* 0: poll(2) before each write of PIPE_BUF bytes */
+  char *out;    /* formatted record */
+  size_t osize;
+  const char *data; /* record being written: out or the compressed out */
+  size_t ooff;
+  size_t olen;
+  char *rec; /* queued record being formatted */
+  size_t recsize;
+  compress_t *z;
+  int zused; /* HEXLOG_COMPRESS: the gzip stream holds data */
+  rotate_t rotate; /* HEXLOG_DIR: name is NULL if the fd is inherited */
+  int magic;       /* capture: the magic starts each file */
+  outbuf_t ob;     /* dumps written synchronously */
+  int64_t due;     /* HEXLOG_OUTPUT_DELAY: time ob is written (ms) */
+  const char *path; /* HEXLOG_SINKS: file opened by hexlog */
+} sink_t;
+
+/* HEXLOG_SINKS: an additional dump output of a stream */
 typedef struct {
+  int fmt;
+  int fd;           /* -1: path */
+  const char *path;
+  sink_t *sink;
+} fanout_t;
+
+typedef struct {
+  int id;          /* child fd: the parent fd has the same number */
+  int dir;         /* IN: parent -> child, OUT: child -> parent */
+  char name[16];   /* stdin, stdout, stderr or fd<id> */
+  char dlabel[16]; /* default label: " (<id>)" */
+  int fmt;
   int fdin;
   int fdout;
-  FILE *fdhex;
+  int fdhex; /* HEXLOG_FD: -1 if HEXLOG_FILE is set */
+  const char *file; /* HEXLOG_FILE: dump file name in HEXLOG_DIR */
   char *label;
-  char buf[8192]; /* XXX */
-  size_t off;
+  size_t labellen;
+  sink_t *sink;
+  queue_t q; /* HEXLOG_OVERFLOW: records waiting for the sink */
+  char *buf;    /* partial line (16 bytes) followed by the read buffer */
+  size_t off;   /* size of the partial line */
+  size_t rsize; /* size of the next read(2): up to HEXLOG_BUFSIZE */
+  int64_t idle; /* HEXLOG_TIMEOUT: time to dump a partial line (ms) */
+  char *pending; /* data not accepted by fdout */
+  size_t psize;
+  size_t poff;
+  size_t plen;
+  int wait; /* fdout is full: stop reading fdin */
+  int eof;  /* fdin closed: close fdout after pending is written */
+  unsigned int mstate; /* HEXLOG_TRIGGER: matcher state */
+  int triggered;       /* dumping data following a start pattern */
+  size_t tleft;        /* HEXLOG_TRIGGER_SIZE: bytes left to dump */
+  char *lb;            /* HEXLOG_TRIGGER_LOOKBACK: data preceding a match */
+  size_t lblen;
+  size_t lbsize;
+  sample_t sample; /* HEXLOG_SAMPLE: dump policy */
+  size_t sampled;  /* bytes skipped by the policy, not yet reported */
+  stats_t *stats;  /* HEXLOG_STATS: NULL if disabled */
+  traffic_t *traffic; /* stats mode: NULL if disabled */
+  digest_t *digest;   /* HEXLOG_DIGEST: NULL if disabled */
+  hexdump_squeeze_t *squeeze; /* HEXLOG_SQUEEZE: NULL if disabled */
+  fanout_t fan[HEXLOG_FANOUT_MAX]; /* HEXLOG_SINKS */
+  size_t nfan;
+  char *fanbuf; /* hexdump shared by the hex outputs */
+  size_t fansize;
+#ifdef HAVE_SPLICE
+  int splice; /* 0: splice(2) not supported by fdin/fdout */
+  int tee[2]; /* raw dump: pipe holding a tee(2) of fdin */
+  size_t teed;
+#endif
 } hexlog_t;
 
+/* relay thread requests */
+enum {
+  RELAY_FLUSH = 1,
+  RELAY_STOP = 2,
+};
+
+/* HEXLOG_FORMAT_WORKERS: a record formatted in slices */
 typedef struct {
+  char *out;
+  const char *data;
+  size_t len;
+  const char *label;
+  size_t labellen;
+} slices_t;
+
+typedef struct state {
   pid_t pid;
   int fdp;
   int fdsig;
   int dir_initial;
-  int dir_cur;
+  atomic_int dir_cur;
   int raw;
-  unsigned int timeout;
+  int traffic; /* stats mode: analyze the streams instead of dumping */
+  unsigned int timeout; /* ms */
+  int64_t now;  /* read once when the event loop wakes up (ms) */
+  int sampling; /* HEXLOG_SAMPLE: a stream uses a sampling policy */
+  int overflow; /* 0: dump synchronously */
+  size_t qsize;
+  size_t bufsize; /* HEXLOG_BUFSIZE */
+  size_t osize;   /* HEXLOG_OUTPUT_SIZE */
+  int64_t odelay; /* HEXLOG_OUTPUT_DELAY (ms) */
+  atomic_size_t seq;
+  int zlevel; /* HEXLOG_COMPRESS: 0: disabled */
+  size_t zblock;
+  pool_t *pool; /* HEXLOG_FORMAT_WORKERS: NULL if disabled */
+  int dirfd;    /* HEXLOG_DIR */
+  size_t rsize; /* HEXLOG_ROTATE_SIZE */
+  int64_t rage; /* HEXLOG_ROTATE_AGE (ms) */
+  size_t ring;  /* HEXLOG_RING_SIZE: 0: disabled */
+  match_t *start;  /* HEXLOG_TRIGGER */
+  match_t *end;    /* HEXLOG_TRIGGER_END */
+  size_t tsize;    /* HEXLOG_TRIGGER_SIZE */
+  size_t lookback; /* HEXLOG_TRIGGER_LOOKBACK */
+  FILE *stats;     /* HEXLOG_STATS */
+  uint64_t ns;     /* HEXLOG_STATS: time the event loop woke up */
+  int64_t interval; /* HEXLOG_STATS_INTERVAL (ms) */
+  int64_t report;   /* time of the next periodic report */
+  match_t *message; /* HEXLOG_DIGEST_MESSAGE */
+  sink_t sink[HEXLOG_SINK_MAX];
+  size_t nsink;
+  size_t nstream;
+  event_t *ev;
+  hexlog_t *h;
+  int thread;      /* HEXLOG_THREAD: sinks are written by the formatter */
+  pthread_t tid;
+  int wake[2];     /* relay -> formatter: records queued */
+  int ready[2];    /* formatter -> relay: queue space available */
+  atomic_int idle; /* formatter: waiting for records */
+  atomic_int full; /* relay: waiting for queue space */
+  atomic_int done; /* relay: no more records will be queued */
+  struct state *sup; /* supervisor: the state shared by the relay threads */
+  struct state *relay[2]; /* HEXLOG_RELAY_THREADS: IN and OUT streams */
+  size_t nrelay;
+  int ctl[2];     /* supervisor -> relay thread: requests queued */
+  atomic_int req; /* relay thread: RELAY_FLUSH, RELAY_STOP */
 } state_t;
 
 extern const char *__progname;
 
-static int sigfd;
+static const int sigs[] = {SIGCHLD, SIGHUP,  SIGUSR1, SIGUSR2,
+                           SIGINT,  SIGTERM, SIGALRM};
+
+/* original file status flags, restored on close and at exit */
+static struct {
+  int fd;
+  int flags;
+} fdflags[HEXLOG_STREAM_MAX * 3];
+static size_t nfdflags;
 
 static int direction(state_t *s, char *name);
+static int format(const char *name);
+static int streams_init(state_t *s, hexlog_t *h, const char *spec);
+static void stream_init(state_t *s, hexlog_t *h);
+static void loop_clock(state_t *s);
+static const char *stream_var(int id, const char *key);
+static int stream_fd(const char *val);
+static int fanout_init(hexlog_t *h, const char *spec);
+static int fanout_uses(hexlog_t *h, int fmt);
+static int fanout_write(hexlog_t *h, int fmt, const void *data, size_t len);
+static int fanout_dump(state_t *s, hexlog_t *h, uint64_t ts,
+                       const void *data, size_t size);
+static int stream_pipe(hexlog_t *h, int *child);
+static int decode(void);
 static int relay(state_t *s, hexlog_t *h);
-static int event_loop(state_t *s, hexlog_t h[2]);
-static ssize_t hexdump(FILE *stream, const char *label, const void *data,
-                       size_t size, int raw);
-static int hexlog_write(int fd, void *buf, size_t size);
-static int hexlog_flush(state_t *s, hexlog_t h[2]);
-
-static int signal_init(void (*handler)(int));
-void sighandler(int sig);
+static int relay_match(state_t *s, hexlog_t *h, const char *buf, size_t n);
+static void lookback(hexlog_t *h, const char *buf, size_t n);
+static match_t *trigger_init(const char *name);
+static int trigger_lookback(state_t *s, hexlog_t *h);
+#ifdef HAVE_SPLICE
+static int splice_init(state_t *s, hexlog_t *h);
+static int relay_splice(state_t *s, hexlog_t *h, int dump);
+static int splice_all(int fdin, int fdout, size_t size);
+static int tee_discard(hexlog_t *h, size_t size);
+#endif
+static int event_loop(state_t *s, hexlog_t *h);
+static int drain(state_t *s, hexlog_t *h);
+static int drain_stream(state_t *s, hexlog_t *c);
+static int hexlog_sample(state_t *s, hexlog_t *h, const char *data,
+                         size_t n);
+static int hexlog_skip(state_t *s, hexlog_t *h);
+static int hexlog_buffer(state_t *s, hexlog_t *h, const char *data,
+                         size_t n);
+static int buffer_init(state_t *s, hexlog_t *h);
+static int hexlog_dump(state_t *s, hexlog_t *h, const void *data,
+                       size_t size);
+static ssize_t hexdump(outbuf_t *o, const char *label, const void *data,
+                       size_t size, int raw, hexdump_squeeze_t *sq);
+static int capture(state_t *s, hexlog_t *h, int type, uint64_t ts,
+                   const void *data, size_t size);
+static size_t capture_fmt(char *dst, hexlog_t *h, const queue_rec_t *rec,
+                          const char *data);
+static void squeeze_skip(hexdump_squeeze_t *sq, size_t n);
+static size_t format_slices(state_t *s, char *dst, hexlog_t *h,
+                            const char *data, size_t len);
+static void format_slice(void *arg, size_t part);
+static int sink_init(state_t *s, hexlog_t *h);
+static sink_t *sink_open(state_t *s, int fd, const char *path);
+static int sink_mixed(unsigned int fmts);
+static int sink_fill(state_t *s, sink_t *k);
+static int sink_format(state_t *s, sink_t *k, int *sync);
+static int sink_put(sink_t *k, const void *data, size_t len);
+static int sink_rotate(sink_t *k);
+static int sink_finish(state_t *s);
+static int sink_write(state_t *s, sink_t *k);
+static int sink_busy(state_t *s, sink_t *k);
+static int sink_sync(state_t *s);
+static int sink_wait(state_t *s);
+static int sink_flush(state_t *s, int all);
+static int ring_dump(state_t *s, hexlog_t *h);
+static int formatter_init(state_t *s, hexlog_t *h);
+static void *formatter(void *arg);
+static int formatter_join(state_t *s);
+static int relay_init(state_t *s, hexlog_t *h);
+static int relay_start(state_t *s);
+static void *relay_thread(void *arg);
+static int relay_request(state_t *s, int req);
+static int relay_stop(state_t *s);
+static int supervise(state_t *s);
+static int doorbell(int fd);
+static int doorbell_clear(int fd);
+static int relay_write(hexlog_t *h, const char *buf, size_t size);
+static int relay_flush(state_t *s, hexlog_t *h);
+static int relay_eof(state_t *s, hexlog_t *h);
+static int relay_close(hexlog_t *h);
+static int relay_readable(state_t *s, hexlog_t *h);
+static int relay_writable(hexlog_t *h);
+static ssize_t hexlog_write(int fd, const void *buf, size_t size,
+                            stats_t *st);
+static int nonblock_init(state_t *s, hexlog_t *h);
+static void nonblock_restore(void);
+static int hexlog_close(int fd);
+static int setnonblock(int fd);
+static int samefile(int fd1, int fd2);
+static int hexlog_alarm(state_t *s, hexlog_t *h);
+static int hexlog_flush(state_t *s, hexlog_t *h);
+static int hexlog_flush_stream(state_t *s, hexlog_t *h);
+static int idle_timeout(state_t *s, hexlog_t *h);
+static int idle_flush(state_t *s, hexlog_t *h);
+static int64_t clock_ms(void);
+static int hexlog_stats(state_t *s, hexlog_t *h);
+static int hexlog_digest(state_t *s, hexlog_t *h, const char *buf,
+                         size_t n);
+static int hexlog_digest_write(state_t *s, hexlog_t *h);
+static int digest_message(state_t *s, hexlog_t *h);
+
 static int sigread(state_t *s);
 
 static noreturn void usage(void);
 
-void sighandler(int sig) {
-  if (write(sigfd, &sig, sizeof(sig)) < 0)
-    (void)close(sigfd);
-}
-
 int main(int argc, char *argv[]) {
   pid_t pid;
-  int fdin[2];
-  int fdout[2];
-  int fdsig[2];
+  int child[HEXLOG_STREAM_MAX]; /* child end of the stream pipes */
+  int fdsig;
   int oerrno;
   int rv;
   int status = 0;
   int fdp = -1; /* capsicum: process descriptor */
   char *stream;
   char *timeout;
+  char *overflow;
+  char *qsize;
+  char *thread;
+  char *fmt;
+  char *compress;
+  char *dir;
+  char *rotate;
+  char *ring;
+  char *trigger;
+  char *stats;
+  char *workers;
+  int nworker = 0; /* HEXLOG_FORMAT_WORKERS */
+  int waited = 0;
+  int relay = 0; /* HEXLOG_RELAY_THREADS */
+  size_t i;
 
   state_t s = {0};
-  hexlog_t h[2] = {0};
+  hexlog_t h[HEXLOG_STREAM_MAX] = {0};
 
   if (restrict_process_init() < 0)
     err(111, "process restriction failed");
 
+  if (argc == 2 && !strcmp(argv[1], "decode"))
+    exit(decode());
+
   if (setvbuf(stdout, NULL, _IOLBF, 0) < 0)
     err(111, "setvbuf");
 
@@ -112,40 +418,267 @@ int main(int argc, char *argv[]) {
   if (direction(&s, argv[1]) < 0)
     usage();
 
+  s.sup = &s;
+
   timeout = getenv("HEXLOG_TIMEOUT");
+  if (timeout != NULL) {
+    s.timeout = (unsigned)atoi(timeout) * 1000;
+  }
+
+  timeout = getenv("HEXLOG_TIMEOUT_MS");
   if (timeout != NULL) {
     s.timeout = (unsigned)atoi(timeout);
   }
 
-  h[0].fdhex = stderr;
-  stream = getenv("HEXLOG_FD_STDIN");
-  if (stream != NULL) {
-    h[0].fdhex = fdopen(atoi(stream), "w");
-    if (h[0].fdhex == NULL)
-      err(111, "fdopen: stdin: %s", stream);
+  overflow = getenv("HEXLOG_OVERFLOW");
+  if (overflow != NULL) {
+    s.overflow = queue_policy(overflow);
+    if (s.overflow < 0)
+      errx(2, "HEXLOG_OVERFLOW: invalid policy: %s", overflow);
+  }
+
+  thread = getenv("HEXLOG_THREAD");
+  if (thread != NULL) {
+    s.thread = atoi(thread);
+    if (s.thread && !s.overflow)
+      s.overflow = QUEUE_BLOCK;
+  }
+
+  s.zblock = HEXLOG_COMPRESS_BLOCK;
+  compress = getenv("HEXLOG_COMPRESS");
+  if (compress != NULL) {
+    s.zlevel = atoi(compress);
+    if (s.zlevel < 0 || s.zlevel > 9)
+      errx(2, "HEXLOG_COMPRESS: invalid level: %s", compress);
+#ifndef HAVE_ZLIB
+    if (s.zlevel > 0)
+      errx(2, "HEXLOG_COMPRESS: not supported");
+#endif
+    /* compression is done when writing the queue to the sink */
+    if (s.zlevel > 0 && !s.overflow)
+      s.overflow = QUEUE_BLOCK;
+  }
+
+  compress = getenv("HEXLOG_COMPRESS_BLOCK");
+  if (compress != NULL) {
+    s.zblock = (size_t)strtoul(compress, NULL, 10);
+  }
+
+  workers = getenv("HEXLOG_FORMAT_WORKERS");
+  if (workers != NULL) {
+    nworker = atoi(workers);
+    if (nworker < 0 || nworker > 256)
+      errx(2, "HEXLOG_FORMAT_WORKERS: invalid number: %s", workers);
+    /* records are formatted when writing the queue to the sink */
+    if (nworker > 0 && !s.overflow)
+      s.overflow = QUEUE_BLOCK;
+  }
+
+  s.bufsize = HEXLOG_BUFSIZE;
+  qsize = getenv("HEXLOG_BUFSIZE");
+  if (qsize != NULL) {
+    s.bufsize = (size_t)strtoul(qsize, NULL, 10);
+    if (s.bufsize < 16)
+      errx(2, "HEXLOG_BUFSIZE: invalid size: %s", qsize);
+  }
+
+  s.osize = HEXLOG_OUTPUT_SIZE;
+  qsize = getenv("HEXLOG_OUTPUT_SIZE");
+  if (qsize != NULL) {
+    s.osize = (size_t)strtoul(qsize, NULL, 10);
+  }
+
+  /* the buffer holds at least a line */
+  if (s.osize < 4096)
+    s.osize = 4096;
+
+  timeout = getenv("HEXLOG_OUTPUT_DELAY");
+  if (timeout != NULL) {
+    s.odelay = (int64_t)strtoul(timeout, NULL, 10);
+  }
+
+  s.qsize = HEXLOG_QUEUE_SIZE;
+  qsize = getenv("HEXLOG_QUEUE_SIZE");
+  if (qsize != NULL) {
+    s.qsize = (size_t)strtoul(qsize, NULL, 10);
+  }
+
+  if (s.qsize < QUEUE_RECSZ(HEXLOG_RECORD_SIZE(&s)))
+    s.qsize = QUEUE_RECSZ(HEXLOG_RECORD_SIZE(&s));
+
+  stream = getenv("HEXLOG_FDS");
+  if (streams_init(&s, h, stream) < 0)
+    errx(2, "HEXLOG_FDS: invalid stream: %s", stream);
+
+  dir = NULL;
+  for (i = 0; i < s.nstream; i++) {
+    stream_init(&s, &h[i]);
+    if (h[i].file != NULL)
+      dir = ".";
+  }
+
+  s.dirfd = -1;
+  if (dir != NULL) {
+    dir = getenv("HEXLOG_DIR");
+    if (dir == NULL)
+      dir = ".";
+
+    s.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s.dirfd < 0)
+      err(111, "open: %s", dir);
+
+    if (restrict_process_dir(dir, s.dirfd) < 0)
+      err(111, "restrict_process_dir");
+
+    /* files are written and rotated by the formatter thread */
+    if (thread == NULL)
+      s.thread = 1;
+    if (!s.overflow)
+      s.overflow = QUEUE_BLOCK;
+  }
+
+  rotate = getenv("HEXLOG_ROTATE_SIZE");
+  if (rotate != NULL) {
+    s.rsize = (size_t)strtoul(rotate, NULL, 10);
+  }
+
+  rotate = getenv("HEXLOG_ROTATE_AGE");
+  if (rotate != NULL) {
+    s.rage = (int64_t)strtoul(rotate, NULL, 10) * 1000;
+  }
+
+  ring = getenv("HEXLOG_RING_SIZE");
+  if (ring != NULL) {
+    s.ring = (size_t)strtoul(ring, NULL, 10);
+  }
+
+  s.start = trigger_init("HEXLOG_TRIGGER");
+  s.end = trigger_init("HEXLOG_TRIGGER_END");
+
+  trigger = getenv("HEXLOG_TRIGGER_SIZE");
+  if (trigger != NULL) {
+    s.tsize = (size_t)strtoul(trigger, NULL, 10);
+  }
+
+  trigger = getenv("HEXLOG_TRIGGER_LOOKBACK");
+  if (trigger != NULL) {
+    s.lookback = (size_t)strtoul(trigger, NULL, 10);
+  }
+
+  stats = getenv("HEXLOG_STATS");
+  if (stats != NULL) {
+    s.stats = fdopen(atoi(stats), "w");
+    if (s.stats == NULL)
+      err(111, "fdopen: stats: %s", stats);
+
+    for (i = 0; i < s.nstream; i++) {
+      h[i].stats = calloc(1, sizeof(stats_t));
+      if (h[i].stats == NULL)
+        err(111, "calloc");
+    }
+  }
+
+  if (s.traffic) {
+    if (s.stats == NULL)
+      s.stats = stderr;
+
+    for (i = 0; i < s.nstream; i++) {
+      h[i].traffic = calloc(1, sizeof(traffic_t));
+      if (h[i].traffic == NULL)
+        err(111, "calloc");
+
+      h[i].traffic->mark_ns = i == 0 ? stats_now() : h[0].traffic->mark_ns;
+    }
+  }
+
+  stats = getenv("HEXLOG_DIGEST");
+  if (stats != NULL) {
+    if (strcmp(stats, "crc32c"))
+      errx(2, "HEXLOG_DIGEST: invalid digest: %s", stats);
+
+    digest_init();
+
+    if (s.stats == NULL)
+      s.stats = stderr;
+
+    for (i = 0; i < s.nstream; i++) {
+      h[i].digest = calloc(1, sizeof(digest_t));
+      if (h[i].digest == NULL)
+        err(111, "calloc");
+    }
+
+    s.message = trigger_init("HEXLOG_DIGEST_MESSAGE");
+  }
+
+  stats = getenv("HEXLOG_STATS_INTERVAL");
+  if (stats != NULL && s.stats != NULL) {
+    s.interval = (int64_t)strtoul(stats, NULL, 10) * 1000;
+    s.now = clock_ms();
+    s.report = s.now + s.interval;
+  }
+
+  /* the queue holds the most recent records until a dump is requested */
+  if (s.ring > 0) {
+    s.overflow = QUEUE_DROP_OLDEST;
+    s.thread = 0;
+    s.qsize = s.ring < QUEUE_RECSZ(HEXLOG_RECORD_SIZE(&s))
+                  ? QUEUE_RECSZ(HEXLOG_RECORD_SIZE(&s))
+                  : s.ring;
   }
 
-  h[1].fdhex = stderr;
-  stream = getenv("HEXLOG_FD_STDOUT");
-  if (stream != NULL) {
-    h[1].fdhex = fdopen(atoi(stream), "w");
-    if (h[1].fdhex == NULL)
-      err(111, "fdopen: stdout: %s", stream);
+  /* the relay threads queue dumps for the formatter thread: a ring is
+   * dumped from all streams and is relayed by the main thread */
+  thread = getenv("HEXLOG_RELAY_THREADS");
+  if (thread != NULL && atoi(thread) && s.ring == 0) {
+    relay = 1;
+    s.thread = 1;
+    if (!s.overflow)
+      s.overflow = QUEUE_BLOCK;
   }
 
-  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fdsig) < 0)
-    err(111, "socketpair");
+  /* HEXLOG_SINKS: each output of a record is formatted once by the
+   * synchronous path */
+  for (i = 0; i < s.nstream; i++) {
+    if (h[i].nfan > 0 && s.overflow)
+      errx(2, "%s: not supported with the dump queue",
+           stream_var(h[i].id, "SINKS"));
+  }
+
+  fmt = getenv("HEXLOG_SQUEEZE");
+  if (fmt != NULL && atoi(fmt)) {
+    for (i = 0; i < s.nstream; i++) {
+      h[i].squeeze = calloc(1, sizeof(hexdump_squeeze_t));
+      if (h[i].squeeze == NULL)
+        err(111, "calloc");
+    }
+  }
+
+  for (i = 0; i < s.nstream; i++) {
+    if (stream_pipe(&h[i], &child[i]) < 0)
+      err(111, "stream_pipe");
+  }
+
+  if (buffer_init(&s, h) < 0)
+    err(111, "buffer_init");
+
+  if (sink_init(&s, h) < 0)
+    err(111, "sink_init");
 
-  sigfd = fdsig[0];
+  if (trigger_lookback(&s, h) < 0)
+    err(111, "trigger_lookback");
 
-  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fdin) < 0)
-    err(111, "socketpair");
+  s.h = h;
 
-  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fdout) < 0)
-    err(111, "socketpair");
+#ifdef HAVE_SPLICE
+  for (i = 0; i < s.nstream; i++) {
+    if (splice_init(&s, &h[i]) < 0)
+      err(111, "splice_init");
+  }
+#endif
 
-  if (signal_init(sighandler) < 0)
-    err(111, "signal_init");
+  fdsig = event_signal_init(sigs, COUNT(sigs));
+  if (fdsig < 0)
+    err(111, "event_signal_init");
 
 #ifdef RESTRICT_PROCESS_capsicum
   pid = pdfork(&fdp, PD_CLOEXEC);
@@ -164,21 +697,23 @@ int main(int argc, char *argv[]) {
     if (restrict_process_signal_on_supervisor_exit() < 0)
       err(111, "restrict_process_signal_on_supervisor_exit");
 
-    if ((close(fdin[1]) < 0) || (close(fdout[1]) < 0) ||
-        (close(fdsig[0]) < 0) || (close(fdsig[1]) < 0))
-      exit(111);
-
-    if (dup2(fdin[0], STDIN_FILENO) < 0)
-      exit(111);
+    for (i = 0; i < s.nstream; i++) {
+      if (close(h[i].dir == IN ? h[i].fdout : h[i].fdin) < 0)
+        exit(111);
+    }
 
-    if (close(fdin[0]) < 0)
+    if (event_signal_child() < 0)
       exit(111);
 
-    if (dup2(fdout[0], STDOUT_FILENO) < 0)
-      exit(111);
+    /* the child ends of the pipes do not use the stream descriptors: the
+     * parent ends of the streams were open when the pipes were created */
+    for (i = 0; i < s.nstream; i++) {
+      if (dup2(child[i], h[i].id) < 0)
+        exit(111);
 
-    if (close(fdout[0]) < 0)
-      exit(111);
+      if (close(child[i]) < 0)
+        exit(111);
+    }
 
     (void)execvp(argv[2], argv + 2);
 
@@ -188,42 +723,87 @@ int main(int argc, char *argv[]) {
     break;
   }
 
+  if (nonblock_init(&s, h) < 0)
+    err(111, "nonblock_init");
+
+  if (relay && relay_init(&s, h) < 0)
+    err(111, "relay_init");
+
+  /* started before the process restrictions: may require a process
+   * rlimit */
+  if (s.thread && formatter_init(&s, h) < 0)
+    err(111, "formatter_init");
+
+  if (relay && relay_start(&s) < 0)
+    err(111, "relay_start");
+
+  if (nworker > 0) {
+    s.pool = pool_init((size_t)nworker);
+    if (s.pool == NULL)
+      err(111, "pool_init");
+  }
+
+  /* slots: see event_loop() and supervise() */
+  s.ev = event_init(relay ? 2 : s.nstream * 3 + 4);
+  if (s.ev == NULL)
+    err(111, "event_init");
+
   if (restrict_process() < 0)
     err(111, "process restriction failed");
 
-  if (close(fdin[0]) < 0)
-    exit(111);
-
-  if (close(fdout[0]) < 0)
-    exit(111);
+  for (i = 0; i < s.nstream; i++) {
+    if (close(child[i]) < 0)
+      exit(111);
+  }
 
   s.pid = pid;
   s.fdp = fdp;
-  s.fdsig = fdsig[1];
+  s.fdsig = fdsig;
 
-  h[0].fdin = STDIN_FILENO;
-  h[0].fdout = fdin[1];
-  h[0].label = getenv("HEXLOG_LABEL_STDIN");
-  if (h[0].label == NULL)
-    h[0].label = " (0)";
+  if (relay) {
+    /* the relay threads may still be running */
+    if (supervise(&s) < 0)
+      err(111, "supervise");
+    rv = 0;
+  } else {
+    rv = event_loop(&s, h);
+  }
+  oerrno = errno;
 
-  h[1].fdin = fdout[1];
-  h[1].fdout = STDOUT_FILENO;
-  h[1].label = getenv("HEXLOG_LABEL_STDOUT");
-  if (h[1].label == NULL)
-    h[1].label = " (1)";
+  event_free(s.ev);
 
-  rv = event_loop(&s, h);
-  oerrno = errno;
+  if (s.ring > 0) {
+    /* HEXLOG_RING_SIZE: dump if the child exited abnormally */
+    if (rv == 0) {
+      if (waitfor(fdp, &status) < 0)
+        err(111, "waitfor");
+      waited = 1;
+    }
 
-  (void)hexlog_flush(&s, h);
+    if (rv < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      (void)ring_dump(&s, h);
+  } else {
+    (void)hexlog_flush(&s, h);
+
+    if (s.thread) {
+      if (formatter_join(&s) < 0)
+        err(111, "formatter_join");
+    } else {
+      (void)sink_sync(&s);
+    }
+  }
+
+  (void)sink_finish(&s);
+
+  if (s.stats != NULL)
+    (void)hexlog_stats(&s, h);
 
   if (rv < 0) {
     errno = oerrno;
     err(111, "event_loop");
   }
 
-  if (waitfor(fdp, &status) < 0)
+  if (!waited && waitfor(fdp, &status) < 0)
     err(111, "waitfor");
 
   if (WIFEXITED(status))
@@ -235,119 +815,239 @@ int main(int argc, char *argv[]) {
   exit(0);
 }
 
-static int signal_init(void (*handler)(int)) {
-  struct sigaction act = {0};
-
-  act.sa_handler = handler;
-  (void)sigfillset(&act.sa_mask);
-
-  if (sigaction(SIGCHLD, &act, NULL) < 0)
-    return -1;
-
-  if (sigaction(SIGHUP, &act, NULL) < 0)
-    return -1;
-
-  if (sigaction(SIGUSR1, &act, NULL) < 0)
-    return -1;
-
-  if (sigaction(SIGUSR2, &act, NULL) < 0)
+static int event_loop(state_t *s, hexlog_t *h) {
+  event_t *ev = s->ev;
+  size_t sig = s->nstream * 2;
+  size_t sink = sig + 2;
+  size_t ready = sink + s->nstream;
+  size_t ctl = ready + 1;
+  size_t i;
+  int req;
+  short revents;
+
+  /* slot i * 2: read: stream source
+   * slot i * 2 + 1: write: stream destination
+   *
+   * stream 0: parent STDIN_FILENO -> child STDIN_FILENO
+   * stream 1: child STDOUT_FILENO -> parent STDOUT_FILENO
+   * stream 2...: HEXLOG_FDS
+   *
+   * slot sink + i: write: dump sink (HEXLOG_OVERFLOW)
+   * slot ready: read: formatter: queue space available (HEXLOG_THREAD)
+   * slot ctl: read: relay thread: supervisor request */
+
+  /* read: parent: signal fd */
+  if (event_set(ev, sig, s->fdsig, POLLIN) < 0)
     return -1;
 
-  if (sigaction(SIGINT, &act, NULL) < 0)
+  /* POLLHUP: parent: indicate child exit */
+  if (event_set(ev, sig + 1, s->fdp, 0) < 0)
     return -1;
 
-  if (sigaction(SIGTERM, &act, NULL) < 0)
+  if (event_set(ev, ready, s->thread ? s->ready[0] : -1, POLLIN) < 0)
     return -1;
 
-  if (sigaction(SIGALRM, &act, NULL) < 0)
+  if (event_set(ev, ctl, s->sup != s ? s->ctl[0] : -1, POLLIN) < 0)
     return -1;
 
-  return 0;
-}
-
-static int event_loop(state_t *s, hexlog_t h[2]) {
-  struct pollfd rfd[5] = {0};
-
-  rfd[0].fd = h[0].fdin; /* read: parent: STDIN_FILENO */
-  rfd[1].fd = h[1].fdin; /* read: child: STDOUT_FILENO */
-  rfd[2].fd = s->fdsig;  /* read: parent: signal fd */
-
-  rfd[3].fd = h[0].fdout; /* write: child STDIN_FILENO */
-
-  rfd[4].fd = s->fdp; /* POLLHUP: parent: indicate child exit */
-
-  rfd[0].events = POLLIN; /* read: parent: STDIN_FILENO */
-  rfd[1].events = POLLIN; /* read: child: STDOUT_FILENO */
-  rfd[2].events = POLLIN; /* read: signal fd */
-
   for (;;) {
-    if (s->timeout > 0)
-      alarm(s->timeout);
+    for (i = 0; s->overflow && !s->thread && !s->ring && i < s->nsink;
+         i++) {
+      if (event_set(ev, sink + i,
+                    sink_busy(s, &s->sink[i]) ? s->sink[i].fd : -1,
+                    POLLOUT) < 0)
+        return -1;
+    }
+
+    for (i = 0; i < s->nstream; i++) {
+      if (event_set(ev, i * 2, relay_readable(s, &h[i]) ? h[i].fdin : -1,
+                    POLLIN) < 0)
+        return -1;
+      /* POLLERR/POLLHUP: destination closed */
+      if (event_set(ev, i * 2 + 1, h[i].fdout,
+                    relay_writable(&h[i]) ? 0 : POLLOUT) < 0)
+        return -1;
+    }
 
-    if (poll(rfd, COUNT(rfd), -1) < 0) {
+    if (event_wait(ev, idle_timeout(s, h)) < 0) {
       if (errno == EINTR)
         continue;
       return -1;
     }
-    if (rfd[3].revents & POLLHUP) {
-      // subprocess closed stdin, ignore stdin
-      if (close(h[0].fdout) < 0)
-        return -1;
-      if (close(h[0].fdin) < 0)
-        return -1;
-      rfd[0].fd = -1;
-      rfd[3].fd = -1;
-      continue;
-    }
-    if (rfd[0].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
-      switch (relay(s, &h[0])) {
-      case 0:
-        if (close(h[0].fdout) < 0)
-          return -1;
-        if (close(h[0].fdin) < 0)
+
+    loop_clock(s);
+
+    if ((event_revents(ev, ready) & POLLIN) &&
+        doorbell_clear(s->ready[0]) < 0)
+      return -1;
+
+    for (i = 0; s->overflow && !s->thread && i < s->nsink; i++) {
+      if (event_revents(ev, sink + i) &
+          (POLLOUT | POLLERR | POLLHUP | POLLNVAL)) {
+        if (sink_write(s, &s->sink[i]) < 0)
           return -1;
-        rfd[0].fd = -1;
-        rfd[3].fd = -1;
-        break;
-      case -1:
-        return -1;
-      default:
-        break;
       }
     }
 
-    if (rfd[1].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
-      switch (relay(s, &h[1])) {
-      case 0:
-        if (close(h[1].fdout) < 0)
+    for (i = 0; i < s->nstream; i++) {
+      revents = event_revents(ev, i * 2 + 1);
+
+      if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        /* stream 0: subprocess closed stdin, ignore stdin */
+        if (relay_close(&h[i]) < 0)
+          return -1;
+        continue;
+      }
+
+      if (revents & POLLOUT) {
+        if (relay_flush(s, &h[i]) < 0)
           return -1;
-        if (close(h[1].fdin) < 0)
+      }
+
+      if (event_revents(ev, i * 2) & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+        switch (relay(s, &h[i])) {
+        case 0:
+          if (relay_eof(s, &h[i]) < 0)
+            return -1;
+          break;
+        case -1:
           return -1;
-        rfd[1].fd = -1;
-        break;
-      case -1:
-        return -1;
-      default:
-        break;
+        case 2:
+          /* destination is full: wait until writable */
+          h[i].wait = 1;
+          break;
+        default:
+          break;
+        }
       }
     }
 
-    if (rfd[2].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+    if (event_revents(ev, sig) & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
       switch (sigread(s)) {
       case 0:
-        return 0;
+        return drain(s, h);
       case -1:
         return -1;
       case 2:
-        (void)hexlog_flush(s, h);
+        if (hexlog_alarm(s, h) < 0)
+          return -1;
         break;
       default:
         break;
       }
     }
 
-    if (rfd[4].revents & POLLHUP) {
+    if (event_revents(ev, sig + 1) & POLLHUP) {
+      return drain(s, h);
+    }
+
+    if (event_revents(ev, ctl) & POLLIN) {
+      if (doorbell_clear(s->ctl[0]) < 0)
+        return -1;
+
+      req = atomic_exchange(&s->req, 0);
+
+      if (req & RELAY_STOP)
+        return drain(s, h);
+
+      if ((req & RELAY_FLUSH) && hexlog_alarm(s, h) < 0)
+        return -1;
+    }
+
+    if (idle_flush(s, h) < 0)
+      return -1;
+
+    if (sink_flush(s, 0) < 0)
+      return -1;
+
+    /* HEXLOG_STATS_INTERVAL: periodic report */
+    if (s->interval > 0 && s->now >= s->report) {
+      if (hexlog_stats(s, h) < 0)
+        return -1;
+      s->report = s->now + s->interval;
+    }
+  }
+}
+
+/* Read the clock once when the event loop wakes up: s->now is used by
+ * the timers and the sampling policies, s->ns by HEXLOG_STATS. */
+static void loop_clock(state_t *s) {
+  if (s->stats != NULL)
+    s->ns = stats_now();
+
+  if (s->timeout > 0 || s->interval > 0 || s->odelay > 0 || s->sampling)
+    s->now = s->stats != NULL ? (int64_t)(s->ns / 1000000) : clock_ms();
+}
+
+/* The child has exited: forward any output remaining in the child's
+ * stdout and output streams. */
+static int drain(state_t *s, hexlog_t *h) {
+  size_t i;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (h[i].dir == OUT && drain_stream(s, &h[i]) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int drain_stream(state_t *s, hexlog_t *c) {
+  struct pollfd fd = {0};
+  int rv;
+
+  for (;;) {
+    if (!relay_writable(c)) {
+      fd.fd = c->fdout;
+      fd.events = POLLOUT;
+      if (poll(&fd, 1, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      if (fd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return relay_close(c);
+      loop_clock(s);
+      if (relay_flush(s, c) < 0)
+        return -1;
+      continue;
+    }
+
+    if (c->fdin == -1)
       return 0;
+
+    if (!relay_readable(s, c)) {
+      /* block: the dump queue is full */
+      if (sink_wait(s) < 0)
+        return -1;
+      continue;
+    }
+
+    fd.fd = c->fdin;
+    fd.events = POLLIN;
+
+    rv = poll(&fd, 1, 0);
+    if (rv < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    loop_clock(s);
+
+    /* no data remaining: treat as EOF */
+    switch (rv == 0 ? 0 : relay(s, c)) {
+    case 0:
+      if (relay_eof(s, c) < 0)
+        return -1;
+      break;
+    case -1:
+      return -1;
+    case 2:
+      c->wait = 1;
+      break;
+    default:
+      break;
     }
   }
 }
@@ -360,11 +1060,10 @@ static void setdir(state_t *s, int dir) {
 }
 
 static int sigread(state_t *s) {
-  ssize_t n;
   int sig;
 
-  n = read(s->fdsig, &sig, sizeof(sig));
-  if (n != sizeof(sig))
+  sig = event_signal_read(s->fdsig);
+  if (sig < 0)
     return -1;
 
   switch (sig) {
@@ -393,128 +1092,2440 @@ static int sigread(state_t *s) {
   return 1;
 }
 
-static int hexlog_flush(state_t *s, hexlog_t h[2]) {
-  if (h[0].off > 0) {
-    if (hexdump(h[0].fdhex, h[0].label, h[0].buf, h[0].off, s->raw) < 0)
-      return -1;
-    h[0].off = 0;
-  }
+/* SIGALRM: dump partial lines and write the statistics. */
+static int hexlog_alarm(state_t *s, hexlog_t *h) {
+  if (s->ring > 0 ? ring_dump(s, h) < 0 : hexlog_flush(s, h) < 0)
+    return -1;
 
-  if (h[1].off > 0) {
-    if (hexdump(h[1].fdhex, h[1].label, h[1].buf, h[1].off, s->raw) < 0)
-      return -1;
-    h[1].off = 0;
-  }
+  if (s->stats != NULL && hexlog_stats(s, h) < 0)
+    return -1;
 
   return 0;
 }
 
-static int relay(state_t *s, hexlog_t *h) {
-  ssize_t n;
-  char buf[4096] = {0};
+static int hexlog_flush(state_t *s, hexlog_t *h) {
+  size_t i;
 
-  while ((n = read(h->fdin, buf, sizeof(buf))) == -1 && errno == EINTR)
-    ;
+  for (i = 0; i < s->nstream; i++) {
+    if (hexlog_flush_stream(s, &h[i]) < 0)
+      return -1;
+  }
 
-  if (n < 1)
-    return n;
+  return sink_flush(s, 1);
+}
 
-  if (hexlog_write(h->fdout, buf, n) == -1)
+/* Dump a partial line. */
+static int hexlog_flush_stream(state_t *s, hexlog_t *h) {
+  if (h->sampled > 0 && hexlog_skip(s, h) < 0)
     return -1;
 
-  switch (h->fdin) {
-  case STDIN_FILENO:
-    if (!(s->dir_cur & IN)) {
-      h->off = 0;
-      return 1;
+  /* report bytes dropped since the last record */
+  if (s->overflow && h->off == 0 &&
+      (h->q.skipped || atomic_load(&h->q.lost))) {
+    if (hexlog_dump(s, h, h->buf, 0) < 0)
+      return -1;
+  }
+
+  if (h->off > 0) {
+    if (hexlog_dump(s, h, HEXLOG_LINE(h), h->off) < 0)
+      return -1;
+    h->off = 0;
+  }
+
+  return 0;
+}
+
+/* Returns the poll(2) timeout until the earliest partial line is due to
+ * be dumped or the next periodic report. */
+static int idle_timeout(state_t *s, hexlog_t *h) {
+  int64_t next = s->interval > 0 ? s->report : -1;
+  size_t i;
+
+  for (i = 0; s->timeout > 0 && i < s->nstream; i++) {
+    if (h[i].off == 0)
+      continue;
+
+    if (next == -1 || h[i].idle < next)
+      next = h[i].idle;
+  }
+
+  /* HEXLOG_OUTPUT_DELAY: buffered dumps */
+  for (i = 0; s->odelay > 0 && i < s->nsink; i++) {
+    if (s->sink[i].ob.len == 0)
+      continue;
+
+    if (next == -1 || s->sink[i].due < next)
+      next = s->sink[i].due;
+  }
+
+  if (next == -1)
+    return -1;
+
+  return next > s->now ? (int)(next - s->now) : 0;
+}
+
+/* HEXLOG_TIMEOUT: dump partial lines of streams idle for the timeout. */
+static int idle_flush(state_t *s, hexlog_t *h) {
+  size_t i;
+
+  if (s->timeout == 0)
+    return 0;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (h[i].off > 0 && h[i].idle <= s->now &&
+        hexlog_flush_stream(s, &h[i]) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int64_t clock_ms(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int hexlog_stats(state_t *s, hexlog_t *h) {
+  size_t i;
+
+  /* the statistics follow the dumps written to the same descriptor */
+  if (sink_flush(s, 1) < 0)
+    return -1;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (h[i].stats != NULL && stats_write(s->stats, h[i].name, h[i].stats) < 0)
+      return -1;
+
+    if (h[i].traffic != NULL &&
+        stats_report(s->stats, h[i].name, h[i].traffic) < 0)
+      return -1;
+
+    if (h[i].digest != NULL && !h[i].digest->done &&
+        hexlog_digest_write(s, &h[i]) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* HEXLOG_DIGEST: update the digest of the stream. With
+ * HEXLOG_DIGEST_MESSAGE, the digest of each message is written when the
+ * end of the message is read. */
+static int hexlog_digest(state_t *s, hexlog_t *h, const char *buf,
+                         size_t n) {
+  digest_t *d = h->digest;
+  size_t end;
+  size_t len;
+  int rv = 0;
+
+  d->bytes += n;
+  d->crc = digest_crc32c(d->crc, buf, n);
+
+  if (s->message == NULL)
+    return 0;
+
+  while ((end = match_scan(s->message, &d->mstate, buf, n, &len)) > 0) {
+    d->mcrc = digest_crc32c(d->mcrc, buf, end);
+    d->mbytes += end;
+
+    if (digest_message(s, h) < 0)
+      return -1;
+
+    buf += end;
+    n -= end;
+    rv = 1;
+  }
+
+  d->mcrc = digest_crc32c(d->mcrc, buf, n);
+  d->mbytes += n;
+
+  return rv && fflush(s->stats) == EOF ? -1 : 0;
+}
+
+/* Write the digest of the stream. At EOF, the digest is final and any
+ * unterminated message is written. */
+static int hexlog_digest_write(state_t *s, hexlog_t *h) {
+  digest_t *d = h->digest;
+
+  if (h->fdin == -1 && d->mbytes > 0 && digest_message(s, h) < 0)
+    return -1;
+
+  if (sink_flush(s, 1) < 0)
+    return -1;
+
+  if (fprintf(s->stats, "%s digest bytes=%" PRIu64 " crc32c=%08" PRIx32 "%s\n",
+              h->name, d->bytes, d->crc,
+              h->fdin == -1 ? " eof" : "") < 0)
+    return -1;
+
+  d->done = h->fdin == -1;
+
+  return fflush(s->stats) == EOF ? -1 : 0;
+}
+
+static int digest_message(state_t *s, hexlog_t *h) {
+  digest_t *d = h->digest;
+
+  d->seq++;
+
+  if (sink_flush(s, 1) < 0)
+    return -1;
+
+  if (fprintf(s->stats,
+              "%s message=%" PRIu64 " bytes=%" PRIu64 " crc32c=%08" PRIx32
+              "\n",
+              h->name, d->seq, d->mbytes, d->mcrc) < 0)
+    return -1;
+
+  d->mbytes = 0;
+  d->mcrc = 0;
+
+  return 0;
+}
+
+static int relay(state_t *s, hexlog_t *h) {
+  ssize_t n;
+  char *buf = h->buf + 16;
+  int dump = s->sup->dir_cur & h->dir;
+  stats_t *st = h->stats;
+  uint64_t start = st != NULL ? stats_sample(&st->relays) : 0;
+  uint64_t now;
+  int queued = h->plen > h->poff;
+
+#ifdef HAVE_SPLICE
+  /* the pending queue is written before switching to splice(2) */
+  if (h->splice && h->plen == h->poff &&
+      (!dump || h->teed > 0 || (h->fmt == FMT_RAW && h->tee[1] != -1))) {
+    n = relay_splice(s, h, dump);
+    if (h->splice) {
+      if (start != 0 && n == 1) {
+        now = stats_now();
+        st->relay_ns += (now - start) * STATS_SAMPLE;
+        stats_latency(st, now - s->ns);
+      }
+      return n;
+    }
+  }
+#endif
+
+  while ((n = read(h->fdin, buf, h->rsize)) == -1 && errno == EINTR) {
+    if (st != NULL)
+      st->eintr++;
+  }
+
+  if (st != NULL)
+    st->reads++;
+
+  if (n == -1 && errno == EAGAIN)
+    return 1;
+
+  if (n < 1)
+    return n;
+
+  /* adapt the read size to the amount of data available: double on a
+   * full read, halve on a read of less than a quarter */
+  if ((size_t)n == h->rsize && h->rsize < s->bufsize)
+    h->rsize = h->rsize * 2 < s->bufsize ? h->rsize * 2 : s->bufsize;
+  else if ((size_t)n < h->rsize / 4 && h->rsize > HEXLOG_READ_SIZE)
+    h->rsize /= 2;
+
+  if (relay_write(h, buf, n) < 0)
+    return -1;
+
+  if (h->traffic != NULL)
+    stats_traffic(h->traffic, buf, n);
+
+  if (h->digest != NULL && hexlog_digest(s, h, buf, n) < 0)
+    return -1;
+
+  /* the latency is measured from the time the event loop woke up */
+  if (start != 0) {
+    now = stats_now();
+    st->relay_ns += (now - start) * STATS_SAMPLE;
+    if (h->plen == h->poff)
+      stats_latency(st, now - s->ns);
+    start = now;
+  }
+
+  if (st != NULL && h->plen > h->poff && !queued)
+    st->pending = s->ns;
+
+  if (!dump) {
+    h->off = 0;
+    return 1;
+  }
+
+  if (s->start != NULL)
+    n = relay_match(s, h, buf, n);
+  else
+    n = hexlog_sample(s, h, buf, n) < 0 ? -1 : 1;
+
+  if (start != 0)
+    st->dump_ns += (stats_now() - start) * STATS_SAMPLE;
+
+  return n;
+}
+
+/* HEXLOG_TRIGGER: dump the data following a start pattern until an end
+ * pattern is matched or HEXLOG_TRIGGER_SIZE bytes are dumped. The match
+ * is preceded by up to HEXLOG_TRIGGER_LOOKBACK bytes of context.
+ *
+ * HEXLOG_RING_SIZE: all data is kept in the ring and a start pattern
+ * dumps the ring. */
+static int relay_match(state_t *s, hexlog_t *h, const char *buf, size_t n) {
+  size_t off = 0;
+  size_t end;
+  size_t len;
+  size_t plen;
+  int stop;
+
+  if (s->ring > 0 && hexlog_sample(s, h, buf, n) < 0)
+    return -1;
+
+  while (off < n) {
+    if (s->ring > 0 || !h->triggered) {
+      end = match_scan(s->start, &h->mstate, buf + off, n - off, &len);
+      if (end == 0) {
+        lookback(h, buf + off, n - off);
+        return 1;
+      }
+
+      lookback(h, buf + off, end);
+      off += end;
+      h->mstate = 0;
+
+      if (s->ring > 0) {
+        if (ring_dump(s, s->h) < 0)
+          return -1;
+        continue;
+      }
+
+      h->triggered = 1;
+      h->tleft = s->tsize;
+
+      /* the context and the match */
+      len += s->lookback;
+      if (len > h->lblen)
+        len = h->lblen;
+
+      if (hexlog_sample(s, h, h->lb + h->lblen - len, len) < 0)
+        return -1;
+
+      h->lblen = 0;
+      continue;
+    }
+
+    stop = 0;
+    len = n - off;
+
+    if (s->tsize > 0 && len >= h->tleft) {
+      len = h->tleft;
+      stop = 1;
+    }
+
+    if (s->end != NULL) {
+      end = match_scan(s->end, &h->mstate, buf + off, len, &plen);
+      if (end > 0) {
+        len = end;
+        stop = 1;
+      }
+    }
+
+    if (hexlog_sample(s, h, buf + off, len) < 0)
+      return -1;
+
+    off += len;
+    if (s->tsize > 0)
+      h->tleft -= len;
+
+    if (stop) {
+      h->triggered = 0;
+      h->mstate = 0;
+      if (hexlog_flush_stream(s, h) < 0)
+        return -1;
+    }
+  }
+
+  return 1;
+}
+
+/* Keep the most recent stream data for HEXLOG_TRIGGER_LOOKBACK. */
+static void lookback(hexlog_t *h, const char *buf, size_t n) {
+  size_t keep;
+
+  if (h->lbsize == 0)
+    return;
+
+  if (n >= h->lbsize) {
+    (void)memcpy(h->lb, buf + n - h->lbsize, h->lbsize);
+    h->lblen = h->lbsize;
+    return;
+  }
+
+  keep = h->lbsize - n;
+  if (h->lblen > keep) {
+    (void)memmove(h->lb, h->lb + h->lblen - keep, keep);
+    h->lblen = keep;
+  }
+
+  (void)memcpy(h->lb + h->lblen, buf, n);
+  h->lblen += n;
+}
+
+static match_t *trigger_init(const char *name) {
+  match_t *m;
+  char *spec;
+
+  spec = getenv(name);
+  if (spec == NULL || *spec == '\0')
+    return NULL;
+
+  m = match_init();
+  if (m == NULL)
+    err(111, "match_init");
+
+  if (match_parse(m, spec) < 0) {
+    if (errno == EINVAL)
+      errx(2, "%s: invalid pattern: %s", name, spec);
+    err(111, "match_parse");
+  }
+
+  if (match_compile(m) < 0)
+    err(111, "match_compile");
+
+  return m;
+}
+
+/* The lookback buffer holds the context and the longest start pattern:
+ * a match may span reads. */
+static int trigger_lookback(state_t *s, hexlog_t *h) {
+  size_t i;
+
+  if (s->start == NULL || s->ring > 0)
+    return 0;
+
+  for (i = 0; i < s->nstream; i++) {
+    h[i].lbsize = s->lookback + match_maxlen(s->start);
+    h[i].lb = malloc(h[i].lbsize);
+    if (h[i].lb == NULL)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* HEXLOG_SAMPLE: apply the stream policy before the data is buffered.
+ * Skipped bytes are reported before the next dumped data. */
+static int hexlog_sample(state_t *s, hexlog_t *h, const char *data,
+                         size_t n) {
+  size_t take;
+
+  if (h->sample.policy == SAMPLE_NONE)
+    return hexlog_buffer(s, h, data, n);
+
+  take = sample_take(&h->sample, s->now, n);
+
+  if (take > 0) {
+    if (h->sampled > 0 && hexlog_skip(s, h) < 0)
+      return -1;
+
+    if (hexlog_buffer(s, h, data, take) < 0)
+      return -1;
+  }
+
+  if (take == n)
+    return 0;
+
+  /* the partial line precedes the skipped bytes */
+  if (h->off > 0) {
+    if (hexlog_dump(s, h, HEXLOG_LINE(h), h->off) < 0)
+      return -1;
+    h->off = 0;
+  }
+
+  h->sampled += n - take;
+
+  return 0;
+}
+
+/* Report the bytes skipped by the sampling policy. */
+static int hexlog_skip(state_t *s, hexlog_t *h) {
+  size_t n = h->sampled;
+  char buf[32];
+  int len;
+
+  h->sampled = 0;
+
+  if (s->overflow) {
+    h->q.skipped += n;
+    return 0;
+  }
+
+  if (fanout_uses(h, FMT_HEX)) {
+    len = snprintf(buf, sizeof(buf), "%zu bytes skipped", n);
+    if (len < 0 || fanout_write(h, FMT_HEX, buf, (size_t)len) < 0 ||
+        fanout_write(h, FMT_HEX, h->label, h->labellen) < 0 ||
+        fanout_write(h, FMT_HEX, "\n", 1) < 0)
+      return -1;
+    squeeze_skip(h->squeeze, n);
+  }
+
+  if (fanout_uses(h, FMT_CAPTURE))
+    return capture(s, h, CAPTURE_SKIPPED, capture_now(), NULL, n);
+
+  return 0;
+}
+
+/* Append stream data to the dump: complete lines are dumped and any
+ * partial line is buffered.
+ *
+ * The partial line is stored in the 16 bytes preceding the read buffer:
+ * data read into the buffer is dumped in place. Data read earlier in the
+ * buffer is moved down to follow the partial line, overwriting only data
+ * already processed by the caller. */
+static int hexlog_buffer(state_t *s, hexlog_t *h, const char *data,
+                         size_t n) {
+  char *rbuf = h->buf + 16;
+  size_t total;
+  size_t chunk;
+  size_t len;
+  size_t rem;
+
+  h->idle = s->now + s->timeout;
+
+  if (data < rbuf || data >= rbuf + s->bufsize) {
+    /* data from another buffer: complete the partial line, then dump
+     * complete lines from the source */
+    if (h->off > 0) {
+      chunk = 16 - h->off < n ? 16 - h->off : n;
+      (void)memmove(h->buf + 16 - h->off - chunk, HEXLOG_LINE(h), h->off);
+      (void)memcpy(h->buf + 16 - chunk, data, chunk);
+      h->off += chunk;
+      data += chunk;
+      n -= chunk;
+
+      if (h->off < 16)
+        return 0;
+
+      if (hexlog_dump(s, h, h->buf, 16) < 0)
+        return -1;
+      h->off = 0;
+    }
+
+    for (; n >= 16; data += chunk, n -= chunk) {
+      chunk = n < s->bufsize ? n : s->bufsize;
+      chunk -= chunk % 16;
+      if (hexlog_dump(s, h, data, chunk) < 0)
+        return -1;
+    }
+
+    (void)memcpy(h->buf + 16 - n, data, n);
+    h->off = n;
+
+    return 0;
+  }
+
+  if (data != rbuf)
+    (void)memmove(rbuf, data, n);
+
+  total = h->off + n;
+  len = total - total % 16;
+  rem = total % 16;
+
+  if (len > 0 && hexlog_dump(s, h, HEXLOG_LINE(h), len) < 0)
+    return -1;
+
+  (void)memmove(h->buf + 16 - rem, HEXLOG_LINE(h) + len, rem);
+  h->off = rem;
+
+  return 0;
+}
+
+/* Allocate the stream buffers: the pending queue holds at least a
+ * read. */
+static int buffer_init(state_t *s, hexlog_t *h) {
+  size_t i;
+
+  for (i = 0; i < s->nstream; i++) {
+    h[i].rsize = HEXLOG_READ_SIZE < s->bufsize ? HEXLOG_READ_SIZE : s->bufsize;
+    h[i].psize =
+        HEXLOG_PENDING_SIZE > s->bufsize ? HEXLOG_PENDING_SIZE : s->bufsize;
+
+    h[i].buf = malloc(16 + s->bufsize);
+    if (h[i].buf == NULL)
+      return -1;
+
+    h[i].pending = malloc(h[i].psize);
+    if (h[i].pending == NULL)
+      return -1;
+  }
+
+  return 0;
+}
+
+#ifdef HAVE_SPLICE
+static int splice_init(state_t *s, hexlog_t *h) {
+  struct stat sb;
+
+  h->tee[0] = -1;
+  h->tee[1] = -1;
+
+  /* stats mode, HEXLOG_DIGEST: the stream data is read by the read(2)
+   * path */
+  h->splice = h->traffic == NULL && h->digest == NULL;
+
+  /* HEXLOG_OVERFLOW: raw dumps are queued by the read(2) path
+   * HEXLOG_TRIGGER, HEXLOG_SAMPLE: the dumped data is selected by the
+   * read(2) path
+   * HEXLOG_SINKS: the data is written to each output */
+  if (h->fmt != FMT_RAW || s->overflow || s->start != NULL ||
+      h->sample.policy != SAMPLE_NONE || h->nfan > 0)
+    return 0;
+
+  /* tee(2): both file descriptors must refer to pipes */
+  if (fstat(h->fdin, &sb) < 0)
+    return -1;
+
+  if (!S_ISFIFO(sb.st_mode))
+    return 0;
+
+  return pipe2(h->tee, O_CLOEXEC);
+}
+
+/* Move data from fdin to fdout without copying through the process.
+ *
+ * Returns 2 if fdout is full: the caller waits for fdout to become
+ * writable before calling relay() again. If the file descriptors do not
+ * support splice(2), h->splice is cleared and any data not forwarded is
+ * left in fdin. */
+static int relay_splice(state_t *s, hexlog_t *h, int dump) {
+  stats_t *st = h->stats;
+  ssize_t n;
+
+  if (!dump && h->teed == 0) {
+    while ((n = splice(h->fdin, NULL, h->fdout, NULL, HEXLOG_SPLICE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+           errno == EINTR) {
+      if (st != NULL)
+        st->eintr++;
+    }
+
+    h->off = 0;
+
+    if (st != NULL && n > 0) {
+      st->splices++;
+      st->bytes += n;
+    }
+
+    if (n == -1) {
+      switch (errno) {
+      case EAGAIN:
+        return 2;
+      case EINVAL:
+        h->splice = 0;
+        return 1;
+      default:
+        return -1;
+      }
+    }
+
+    return n == 0 ? 0 : 1;
+  }
+
+  /* Raw dump: the head of fdin is duplicated into the tee pipe. h->teed
+   * is the number of duplicated bytes not yet forwarded. */
+  if (h->teed == 0) {
+    /* write out any data buffered by the read(2) path */
+    if (h->off > 0) {
+      if (hexlog_dump(s, h, HEXLOG_LINE(h), h->off) < 0)
+        return -1;
+      h->off = 0;
+    }
+
+    if (outbuf_flush(&h->sink->ob) < 0)
+      return -1;
+
+    while ((n = tee(h->fdin, h->tee[1], HEXLOG_SPLICE_SIZE,
+                    SPLICE_F_NONBLOCK)) == -1 &&
+           errno == EINTR)
+      ;
+
+    if (n == -1 && errno == EAGAIN)
+      return 1;
+
+    if (n < 1)
+      return n;
+
+    h->teed = n;
+  }
+
+  while ((n = splice(h->fdin, NULL, h->fdout, NULL, h->teed,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+         errno == EINTR) {
+    if (st != NULL)
+      st->eintr++;
+  }
+
+  if (n == -1) {
+    switch (errno) {
+    case EAGAIN:
+      return 2;
+    case EINVAL:
+      h->splice = 0;
+      return tee_discard(h, 0);
+    default:
+      return -1;
+    }
+  }
+
+  if (n == 0) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  h->teed -= n;
+
+  if (st != NULL) {
+    st->splices++;
+    st->bytes += n;
+  }
+
+  if (splice_all(h->tee[0], h->fdhex, n) < 0) {
+    if (errno != EINVAL)
+      return -1;
+    /* dump file descriptor does not support splice(2): use the read(2)
+     * path for the raw dump */
+    return tee_discard(h, n);
+  }
+
+  return 1;
+}
+
+static int splice_all(int fdin, int fdout, size_t size) {
+  ssize_t n;
+  size_t off = 0;
+
+  do {
+    n = splice(fdin, NULL, fdout, NULL, size - off, SPLICE_F_MOVE);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+    if (n == 0) {
+      errno = EPIPE;
+      return -1;
+    }
+    off += n;
+  } while (off < size);
+
+  return 0;
+}
+
+/* Copy size bytes of forwarded data from the tee pipe to the dump and
+ * close the tee pipe, discarding any data not yet forwarded: the data is
+ * read again from fdin. */
+static int tee_discard(hexlog_t *h, size_t size) {
+  char buf[4096];
+  ssize_t n;
+
+  while (size > 0) {
+    n = read(h->tee[0], buf, size < sizeof(buf) ? size : sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    if (outbuf_write(&h->sink->ob, buf, n) < 0)
+      return -1;
+    size -= n;
+  }
+
+  if (close(h->tee[0]) < 0 || close(h->tee[1]) < 0)
+    return -1;
+
+  h->tee[0] = -1;
+  h->tee[1] = -1;
+  h->teed = 0;
+
+  return 1;
+}
+#endif
+
+/* Write data to the stream destination. Any data not accepted by the
+ * destination is appended to the pending queue. */
+static int relay_write(hexlog_t *h, const char *buf, size_t size) {
+  ssize_t n = 0;
+
+  if (h->plen == h->poff) {
+    n = hexlog_write(h->fdout, buf, size, h->stats);
+    if (n < 0)
+      return -1;
+  }
+
+  if ((size_t)n == size)
+    return 0;
+
+  if (h->plen + (size - n) > h->psize) {
+    (void)memmove(h->pending, h->pending + h->poff, h->plen - h->poff);
+    h->plen -= h->poff;
+    h->poff = 0;
+  }
+
+  (void)memcpy(h->pending + h->plen, buf + n, size - n);
+  h->plen += size - n;
+
+  return 0;
+}
+
+/* The stream destination is writable: write out the pending queue. */
+static int relay_flush(state_t *s, hexlog_t *h) {
+  ssize_t n;
+  uint64_t start;
+
+  h->wait = 0;
+
+  if (h->plen > h->poff) {
+    start = h->stats != NULL ? stats_sample(&h->stats->relays) : 0;
+
+    n = hexlog_write(h->fdout, h->pending + h->poff, h->plen - h->poff,
+                     h->stats);
+    if (n < 0)
+      return -1;
+
+    if (start != 0)
+      h->stats->relay_ns += (stats_now() - start) * STATS_SAMPLE;
+
+    h->poff += n;
+    if (h->poff < h->plen)
+      return 0;
+
+    h->poff = 0;
+    h->plen = 0;
+
+    if (start != 0)
+      stats_latency(h->stats, s->ns - h->stats->pending);
+  }
+
+  if (h->eof && h->fdout != -1) {
+    if (hexlog_close(h->fdout) < 0)
+      return -1;
+    h->fdout = -1;
+  }
+
+  return 0;
+}
+
+/* The stream source reached EOF: the destination is closed after the
+ * pending queue is written. */
+static int relay_eof(state_t *s, hexlog_t *h) {
+  if (hexlog_close(h->fdin) < 0)
+    return -1;
+
+  h->fdin = -1;
+  h->eof = 1;
+
+  if (h->digest != NULL && hexlog_digest_write(s, h) < 0)
+    return -1;
+
+  if (h->plen > h->poff)
+    return 0;
+
+  return relay_flush(s, h);
+}
+
+/* The stream destination was closed: discard the stream. */
+static int relay_close(hexlog_t *h) {
+  if (h->fdin != -1 && hexlog_close(h->fdin) < 0)
+    return -1;
+
+  if (h->fdout != -1 && hexlog_close(h->fdout) < 0)
+    return -1;
+
+  h->fdin = -1;
+  h->fdout = -1;
+  h->wait = 0;
+  h->poff = 0;
+  h->plen = 0;
+
+  return 0;
+}
+
+/* Read from the stream source unless the destination is blocked or, for
+ * the block overflow policy, the dump queue is full. */
+static int relay_readable(state_t *s, hexlog_t *h) {
+  if (h->fdin == -1 || h->wait ||
+      h->plen - h->poff + h->rsize > h->psize)
+    return 0;
+
+  if (s->overflow == QUEUE_BLOCK && (s->sup->dir_cur & h->dir) &&
+      queue_free(&h->q) < QUEUE_RECSZ(h->rsize + 16)) {
+    if (!s->thread)
+      return 0;
+
+    /* ask the formatter for a wakeup, then check for space freed in
+     * the meantime */
+    atomic_store(&s->full, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (queue_free(&h->q) < QUEUE_RECSZ(h->rsize + 16))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* No writes to the stream destination are waiting. */
+static int relay_writable(hexlog_t *h) {
+  return h->fdout == -1 || (!h->wait && h->plen == h->poff);
+}
+
+/* Set O_NONBLOCK on the stream file descriptors.
+ *
+ * The flag applies to the open file description and is visible to any
+ * other process sharing it: the parent end of a stream is left blocking
+ * if it is a terminal or refers to the same file as a dump. A dump sink is left
+ * blocking if it is a terminal or shared with the child as stderr. */
+static int nonblock_init(state_t *s, hexlog_t *h) {
+  struct stat sb;
+  size_t i, j;
+  int fd;
+
+  /* the parent end of the pipe to the child */
+  for (i = 0; i < s->nstream; i++) {
+    if (setnonblock(h[i].dir == IN ? h[i].fdout : h[i].fdin) < 0)
+      return -1;
+  }
+
+  for (i = 0; i < s->nstream; i++) {
+    fd = h[i].id;
+
+    if (isatty(fd) || samefile(fd, STDERR_FILENO))
+      continue;
+
+    for (j = 0; j < s->nsink; j++) {
+      if (samefile(fd, s->sink[j].fd))
+        break;
+    }
+
+    if (j < s->nsink)
+      continue;
+
+    if (setnonblock(fd) < 0)
+      return -1;
+  }
+
+  for (i = 0; s->overflow && i < s->nsink; i++) {
+    fd = s->sink[i].fd;
+
+    /* the formatter thread blocks in write(2) */
+    if (s->thread) {
+      s->sink[i].nonblock = 1;
+      continue;
+    }
+
+    /* writes to regular files do not wait for the reader */
+    if (fstat(fd, &sb) < 0)
+      return -1;
+
+    if (S_ISREG(sb.st_mode)) {
+      s->sink[i].nonblock = 1;
+      continue;
+    }
+
+    if (isatty(fd) || samefile(fd, STDERR_FILENO))
+      continue;
+
+    if (setnonblock(fd) < 0)
+      return -1;
+
+    s->sink[i].nonblock = 1;
+  }
+
+  return atexit(nonblock_restore) == 0 ? 0 : -1;
+}
+
+static void nonblock_restore(void) {
+  size_t i;
+
+  for (i = 0; i < nfdflags; i++) {
+    if (fdflags[i].fd != -1)
+      (void)fcntl(fdflags[i].fd, F_SETFL, fdflags[i].flags);
+  }
+}
+
+/* Close a stream file descriptor, restoring the original file status
+ * flags. The parent stderr is left open for dumps and errors. */
+static int hexlog_close(int fd) {
+  size_t i;
+
+  if (fd == STDERR_FILENO)
+    return 0;
+
+  for (i = 0; i < nfdflags; i++) {
+    if (fdflags[i].fd == fd) {
+      (void)fcntl(fd, F_SETFL, fdflags[i].flags);
+      fdflags[i].fd = -1;
+    }
+  }
+
+  return close(fd);
+}
+
+static int setnonblock(int fd) {
+  int flags;
+
+  flags = fcntl(fd, F_GETFL);
+  if (flags == -1)
+    return -1;
+
+  if (nfdflags >= COUNT(fdflags)) {
+    errno = EMFILE;
+    return -1;
+  }
+
+  fdflags[nfdflags].fd = fd;
+  fdflags[nfdflags].flags = flags;
+  nfdflags++;
+
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Returns 1 if both file descriptors refer to the same file or if either
+ * file descriptor is not valid. */
+static int samefile(int fd1, int fd2) {
+  struct stat sb1;
+  struct stat sb2;
+
+  if (fstat(fd1, &sb1) < 0 || fstat(fd2, &sb2) < 0)
+    return 1;
+
+  return sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
+}
+
+/* Write as much data as the destination accepts without blocking. The
+ * calls are counted in st if not NULL. */
+static ssize_t hexlog_write(int fd, const void *buf, size_t size,
+                            stats_t *st) {
+  ssize_t n;
+  size_t off = 0;
+
+  do {
+    n = write(fd, (const char *)buf + off, size - off);
+    if (st != NULL)
+      st->writes++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        if (st != NULL)
+          st->eintr++;
+        continue;
+      }
+
+      if (errno == EAGAIN)
+        break;
+
+      return -1;
+    }
+    off += n;
+  } while (off < size);
+
+  if (st != NULL) {
+    st->bytes += off;
+    if (off < size)
+      st->short_writes++;
+  }
+
+  return off;
+}
+
+/* Dump stream data: written immediately or, if HEXLOG_OVERFLOW is set,
+ * queued for the sink. */
+static int hexlog_dump(state_t *s, hexlog_t *h, const void *data,
+                       size_t size) {
+  uint64_t ts =
+      fanout_uses(h, FMT_CAPTURE) || s->ring > 0 ? capture_now() : 0;
+  uint64_t start;
+  int rv;
+
+  if (!s->overflow) {
+    start = h->stats != NULL ? stats_sample(&h->stats->records) : 0;
+
+    if (h->nfan > 0)
+      rv = fanout_dump(s, h, ts, data, size);
+    else if (h->fmt == FMT_CAPTURE)
+      rv = capture(s, h, CAPTURE_DATA, ts, data, size);
+    else
+      rv = hexdump(&h->sink->ob, h->label, data, size, h->fmt == FMT_RAW,
+                   h->squeeze) < 0
+               ? -1
+               : 0;
+
+    if (h->stats != NULL)
+      stats_format(h->stats, size, start);
+
+    return rv;
+  }
+
+  (void)queue_push(&h->q, s->sup->seq++, ts, data, size);
+
+  if (!s->thread)
+    return 0;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_exchange(&s->sup->idle, 0))
+    return doorbell(s->sup->wake[1]);
+
+  return 0;
+}
+
+static int sink_init(state_t *s, hexlog_t *h) {
+  sink_t *k;
+  size_t labellen;
+  size_t i, j, m;
+  unsigned int fmts;
+  const char *capture;
+
+  for (i = 0; i < s->nstream; i++) {
+    h[i].labellen = strlen(h[i].label);
+
+    for (j = 0; j < s->nsink; j++) {
+      k = &s->sink[j];
+      if (h[i].file == NULL) {
+        if (k->rotate.name == NULL && k->path == NULL && k->fd == h[i].fdhex)
+          break;
+      } else if (k->rotate.name != NULL && !strcmp(k->rotate.name, h[i].file)) {
+        break;
+      }
+    }
+
+    if (j == s->nsink) {
+      k = &s->sink[j];
+      s->nsink++;
+
+      if (h[i].file == NULL) {
+        k->fd = h[i].fdhex;
+      } else {
+        k->rotate.dirfd = s->dirfd;
+        k->rotate.name = h[i].file;
+        k->rotate.size = s->rsize;
+        k->rotate.age = s->rage;
+        k->fd = rotate_open(&k->rotate, clock_ms());
+        if (k->fd < 0)
+          return -1;
+      }
+    }
+
+    h[i].sink = &s->sink[j];
+  }
+
+  for (i = 0; i < s->nstream; i++) {
+    for (j = 0; j < h[i].nfan; j++) {
+      h[i].fan[j].sink = sink_open(s, h[i].fan[j].fd, h[i].fan[j].path);
+      if (h[i].fan[j].sink == NULL)
+        return -1;
+    }
+
+    if (h[i].nfan == 0 || !fanout_uses(&h[i], FMT_HEX))
+      continue;
+
+    h[i].fansize = (HEXLOG_RECORD_SIZE(s) / 16 + 1) *
+                   (HEXDUMP_OFFSET_MAX + HEXDUMP_LINE_MAX + h[i].labellen + 1);
+    h[i].fanbuf = malloc(h[i].fansize);
+    if (h[i].fanbuf == NULL)
+      return -1;
+  }
+
+  for (j = 0; !s->overflow && j < s->nsink; j++) {
+    if (outbuf_init(&s->sink[j].ob, s->sink[j].fd, s->osize) < 0)
+      return -1;
+  }
+
+  for (j = 0; j < s->nsink && s->zlevel > 0; j++) {
+    s->sink[j].z = compress_init(s->zlevel, s->zblock);
+    if (s->sink[j].z == NULL)
+      return -1;
+  }
+
+  /* capture records are binary: an output written in the capture
+   * format cannot be shared with the hex or raw formats */
+  for (j = 0; j < s->nsink; j++) {
+    fmts = 0;
+    capture = NULL;
+    for (i = 0; i < s->nstream; i++) {
+      if (h[i].sink == &s->sink[j]) {
+        fmts |= 1U << h[i].fmt;
+        if (h[i].fmt == FMT_CAPTURE && capture == NULL)
+          capture = stream_var(h[i].id, "FORMAT");
+      }
+
+      for (m = 0; m < h[i].nfan; m++) {
+        if (h[i].fan[m].sink != &s->sink[j])
+          continue;
+        fmts |= 1U << h[i].fan[m].fmt;
+        if (h[i].fan[m].fmt == FMT_CAPTURE && capture == NULL)
+          capture = stream_var(h[i].id, "SINKS");
+      }
+    }
+
+    /* the variable selecting the capture format is reported */
+    if (sink_mixed(fmts))
+      errx(2, "%s: capture output shared with another format", capture);
+
+    s->sink[j].magic = fmts == 1U << FMT_CAPTURE;
+  }
+
+  for (j = 0; j < s->nsink; j++) {
+    if (s->sink[j].magic &&
+        sink_put(&s->sink[j], CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) < 0)
+      return -1;
+  }
+
+  if (!s->overflow)
+    return 0;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (queue_init(&h[i].q, s->qsize, s->overflow) < 0)
+      return -1;
+  }
+
+  /* the buffer holds a formatted record for any stream using the sink */
+  for (j = 0; j < s->nsink; j++) {
+    k = &s->sink[j];
+
+    labellen = 0;
+    for (i = 0; i < s->nstream; i++) {
+      if (h[i].sink == k && h[i].labellen > labellen)
+        labellen = h[i].labellen;
+    }
+
+    k->osize = 64 + labellen +
+               (HEXLOG_RECORD_SIZE(s) / 16 + 1) *
+                   (HEXDUMP_OFFSET_MAX + HEXDUMP_LINE_MAX + labellen + 1);
+    k->out = malloc(k->osize);
+    if (k->out == NULL)
+      return -1;
+
+    k->recsize = HEXLOG_RECORD_SIZE(s);
+    k->rec = malloc(k->recsize);
+    if (k->rec == NULL)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Returns 1 if the set of formats written to a sink mixes the capture
+ * format with another format. */
+static int sink_mixed(unsigned int fmts) {
+  return (fmts & (1U << FMT_CAPTURE)) && fmts != 1U << FMT_CAPTURE;
+}
+
+/* HEXLOG_SINKS: returns the sink writing to the descriptor or, if path
+ * is set, to the file. The file is created or truncated. */
+static sink_t *sink_open(state_t *s, int fd, const char *path) {
+  sink_t *k;
+  size_t j;
+
+  for (j = 0; j < s->nsink; j++) {
+    k = &s->sink[j];
+    if (k->rotate.name != NULL)
+      continue;
+
+    if (path == NULL ? k->path == NULL && k->fd == fd
+                     : k->path != NULL && !strcmp(k->path, path))
+      return k;
+  }
+
+  if (s->nsink == HEXLOG_SINK_MAX) {
+    errno = EMFILE;
+    return NULL;
+  }
+
+  k = &s->sink[s->nsink];
+
+  if (path != NULL) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+      err(111, "open: %s", path);
+
+    if (restrict_process_file(fd) < 0)
+      err(111, "restrict_process_file");
+  }
+
+  k->fd = fd;
+  k->path = path;
+  s->nsink++;
+
+  return k;
+}
+
+/* Prepare the next write to the sink. Returns 0 if no records are
+ * queued. */
+static int sink_fill(state_t *s, sink_t *k) {
+  int sync = 0;
+  int rv;
+
+  for (;;) {
+    rv = sink_format(s, k, &sync);
+    if (rv <= 0)
+      return rv;
+
+    /* HEXLOG_DIR: files start at a record boundary */
+    if (k->rotate.name != NULL && rotate_due(&k->rotate, clock_ms()) &&
+        sink_rotate(k) < 0)
+      return -1;
+
+    k->data = k->out;
+
+    if (k->z == NULL)
+      return 1;
+
+    /* the compressor may buffer the record */
+    if (compress_data(k->z, k->out, k->olen, sync, &k->data, &k->olen) < 0)
+      return -1;
+
+    k->zused = 1;
+
+    if (k->olen > 0)
+      return 1;
+  }
+}
+
+/* Format the oldest record queued for the sink. Returns 0 if no records
+ * are queued. A partial line sets sync: the record was dumped by a
+ * flush. */
+static int sink_format(state_t *s, sink_t *k, int *sync) {
+  hexlog_t *h = s->h;
+  char *data = k->rec;
+  queue_rec_t rec;
+  hexlog_t *next = NULL;
+  size_t seq = 0;
+  size_t consumed;
+  uint64_t start;
+  size_t i;
+  int n;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (h[i].sink != k || !queue_peek(&h[i].q, &rec))
+      continue;
+
+    if (next == NULL || rec.seq < seq) {
+      next = &h[i];
+      seq = rec.seq;
     }
+  }
+
+  if (next == NULL)
+    return 0;
+
+  if (queue_pop(&next->q, &rec, data, k->recsize) < 0) {
+    errno = EOVERFLOW;
+    return -1;
+  }
+
+  k->ooff = 0;
+  k->olen = 0;
+
+  *sync = rec.len % 16 != 0 || rec.len == 0;
+
+  start = next->stats != NULL ? stats_sample(&next->stats->records) : 0;
+
+  switch (next->fmt) {
+  case FMT_RAW:
+    (void)memcpy(k->out, data, rec.len);
+    k->olen = rec.len;
+    break;
+  case FMT_CAPTURE:
+    k->olen = capture_fmt(k->out, next, &rec, data);
     break;
   default:
-    if (!(s->dir_cur & OUT)) {
-      h->off = 0;
+    if (rec.skipped > 0) {
+      n = snprintf(k->out, k->osize, "%zu bytes skipped%s\n", rec.skipped,
+                   next->label);
+      if (n < 0)
+        return -1;
+      k->olen = (size_t)n < k->osize ? (size_t)n : k->osize - 1;
+      squeeze_skip(next->squeeze, rec.skipped);
+    }
+
+    if (next->squeeze != NULL)
+      k->olen += hexdump_fmt_squeeze(k->out + k->olen, k->osize - k->olen,
+                                     next->label, next->labellen, data,
+                                     rec.len, &consumed, next->squeeze);
+    else if (s->pool != NULL && rec.len >= 2 * HEXLOG_SLICE_SIZE)
+      k->olen += format_slices(s, k->out + k->olen, next, data, rec.len);
+    else
+      k->olen += hexdump_fmt(k->out + k->olen, k->osize - k->olen,
+                             next->label, next->labellen, data, rec.len,
+                             &consumed);
+    break;
+  }
+
+  if (next->stats != NULL)
+    stats_format(next->stats, rec.len, start);
+
+  return 1;
+}
+
+/* The sink is writable: write out queued records. */
+static int sink_write(state_t *s, sink_t *k) {
+  struct pollfd fd = {0};
+  ssize_t n;
+  size_t len;
+
+  fd.fd = k->fd;
+  fd.events = POLLOUT;
+
+  for (;;) {
+    if (k->ooff == k->olen) {
+      switch (sink_fill(s, k)) {
+      case 0:
+        return 0;
+      case -1:
+        return -1;
+      default:
+        break;
+      }
+    }
+
+    len = k->olen - k->ooff;
+
+    /* a blocking descriptor accepts PIPE_BUF bytes without blocking
+     * after poll(2) reports it is writable */
+    if (!k->nonblock && len > PIPE_BUF)
+      len = PIPE_BUF;
+
+    n = write(k->fd, k->data + k->ooff, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        return 0;
+      return -1;
+    }
+
+    k->ooff += n;
+    k->rotate.written += n;
+
+    if (!k->nonblock) {
+      n = poll(&fd, 1, 0);
+      if (n < 0)
+        return errno == EINTR ? 0 : -1;
+      if (n == 0 || !(fd.revents & POLLOUT))
+        return 0;
+    }
+  }
+}
+
+/* Returns 1 if data is waiting to be written to the sink. */
+static int sink_busy(state_t *s, sink_t *k) {
+  hexlog_t *h = s->h;
+  size_t i;
+
+  if (k->ooff < k->olen)
+    return 1;
+
+  for (i = 0; i < s->nstream; i++) {
+    if (h[i].sink == k && queue_pending(&h[i].q))
       return 1;
+  }
+
+  return 0;
+}
+
+/* Write out all queued records. */
+static int sink_sync(state_t *s) {
+  struct pollfd fd = {0};
+  size_t i;
+
+  for (i = 0; s->overflow && i < s->nsink; i++) {
+    fd.fd = s->sink[i].fd;
+    fd.events = POLLOUT;
+
+    while (sink_busy(s, &s->sink[i])) {
+      if (poll(&fd, 1, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+
+      if (sink_write(s, &s->sink[i]) < 0)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Write data to the sink before the event loop starts. */
+static int sink_put(sink_t *k, const void *data, size_t len) {
+  const char *out = data;
+  size_t outlen = len;
+
+  if (k->z != NULL) {
+    if (compress_data(k->z, data, len, 0, &out, &outlen) < 0)
+      return -1;
+    k->zused = 1;
+  }
+
+  k->rotate.written += outlen;
+
+  return hexlog_write(k->fd, out, outlen, NULL) == (ssize_t)outlen ? 0 : -1;
+}
+
+/* HEXLOG_DIR: close the dump file and open the next file. A compressed
+ * file is ended and the next file starts a new gzip stream. */
+static int sink_rotate(sink_t *k) {
+  const char *out;
+  size_t outlen;
+  int fd;
+
+  if (k->z != NULL && k->zused) {
+    if (compress_finish(k->z, &out, &outlen) < 0)
+      return -1;
+
+    if (hexlog_write(k->fd, out, outlen, NULL) != (ssize_t)outlen)
+      return -1;
+
+    if (compress_reset(k->z) < 0)
+      return -1;
+
+    k->zused = 0;
+  }
+
+  fd = rotate_open(&k->rotate, clock_ms());
+  if (fd < 0)
+    return -1;
+
+  (void)close(k->fd);
+  k->fd = fd;
+
+  if (k->magic)
+    return sink_put(k, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+
+  return 0;
+}
+
+/* HEXLOG_COMPRESS: write the end of the compressed streams. A sink
+ * without data is left empty. */
+static int sink_finish(state_t *s) {
+  struct pollfd fd = {0};
+  sink_t *k;
+  ssize_t n;
+  size_t i;
+
+  for (i = 0; i < s->nsink; i++) {
+    k = &s->sink[i];
+    if (k->z == NULL || !k->zused)
+      continue;
+
+    if (compress_finish(k->z, &k->data, &k->olen) < 0)
+      return -1;
+
+    fd.fd = k->fd;
+    fd.events = POLLOUT;
+
+    for (k->ooff = 0; k->ooff < k->olen; k->ooff += n) {
+      n = hexlog_write(k->fd, k->data + k->ooff, k->olen - k->ooff,
+                       NULL);
+      if (n < 0)
+        return -1;
+      if (n == 0 && poll(&fd, 1, -1) < 0 && errno != EINTR)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Write out the dumps buffered by the synchronous path. With
+ * HEXLOG_OUTPUT_DELAY, a buffer is written when the delay expires unless
+ * all is set. */
+static int sink_flush(state_t *s, int all) {
+  sink_t *k;
+  size_t i;
+
+  for (i = 0; !s->overflow && i < s->nsink; i++) {
+    k = &s->sink[i];
+    if (k->ob.len == 0)
+      continue;
+
+    if (!all && s->odelay > 0) {
+      if (k->due == 0)
+        k->due = s->now + s->odelay;
+      if (k->due > s->now)
+        continue;
+    }
+
+    k->due = 0;
+    if (outbuf_flush(&k->ob) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* block: wait for space in the dump queue */
+static int sink_wait(state_t *s) {
+  struct pollfd fd = {0};
+
+  if (!s->thread)
+    return sink_sync(s);
+
+  fd.fd = s->ready[0];
+  fd.events = POLLIN;
+
+  if (poll(&fd, 1, -1) < 0)
+    return errno == EINTR ? 0 : -1;
+
+  return doorbell_clear(s->ready[0]);
+}
+
+/* HEXLOG_RING_SIZE: format and write out the data held in the stream
+ * queues. Data dropped from the queues is reported as skipped. */
+static int ring_dump(state_t *s, hexlog_t *h) {
+  if (hexlog_flush(s, h) < 0)
+    return -1;
+
+  return sink_sync(s);
+}
+
+/* Start a thread to format and write the dump queues. The relay thread
+ * reads, forwards and queues stream data. */
+static int formatter_init(state_t *s, hexlog_t *h) {
+  sigset_t set;
+  sigset_t oset;
+  int rv;
+
+  s->h = h;
+
+  if (pipe(s->wake) < 0 || pipe(s->ready) < 0)
+    return -1;
+
+  if (fcntl(s->wake[0], F_SETFL, O_NONBLOCK) < 0 ||
+      fcntl(s->wake[1], F_SETFL, O_NONBLOCK) < 0 ||
+      fcntl(s->ready[0], F_SETFL, O_NONBLOCK) < 0 ||
+      fcntl(s->ready[1], F_SETFL, O_NONBLOCK) < 0)
+    return -1;
+
+  /* signals are handled by the relay thread */
+  (void)sigfillset(&set);
+  if (pthread_sigmask(SIG_SETMASK, &set, &oset) != 0)
+    return -1;
+
+  rv = pthread_create(&s->tid, NULL, formatter, s);
+
+  (void)pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+  if (rv != 0) {
+    errno = rv;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void *formatter(void *arg) {
+  state_t *s = arg;
+  struct pollfd fds[HEXLOG_STREAM_MAX + 1] = {0};
+  size_t w = s->nsink; /* wake */
+  size_t i;
+  int busy;
+
+  for (;;) {
+    busy = 0;
+    for (i = 0; i < s->nsink; i++) {
+      fds[i].fd = sink_busy(s, &s->sink[i]) ? s->sink[i].fd : -1;
+      fds[i].events = POLLOUT;
+      if (fds[i].fd != -1)
+        busy = 1;
+    }
+
+    fds[w].fd = -1;
+
+    if (!busy) {
+      /* request a wakeup, then check for records queued in the
+       * meantime */
+      atomic_store(&s->idle, 1);
+      atomic_thread_fence(memory_order_seq_cst);
+
+      for (i = 0; i < s->nsink; i++)
+        busy |= sink_busy(s, &s->sink[i]);
+
+      if (busy) {
+        atomic_store(&s->idle, 0);
+        continue;
+      }
+
+      if (atomic_load(&s->done))
+        return NULL;
+
+      fds[w].fd = s->wake[0];
+      fds[w].events = POLLIN;
+    }
+
+    if (poll(fds, w + 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      err(111, "formatter: poll");
+    }
+
+    if ((fds[w].revents & POLLIN) && doorbell_clear(s->wake[0]) < 0)
+      err(111, "formatter: read");
+
+    for (i = 0; i < s->nsink; i++) {
+      if (fds[i].fd == -1 ||
+          !(fds[i].revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL)))
+        continue;
+
+      if (sink_write(s, &s->sink[i]) < 0)
+        err(111, "formatter: write");
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&s->full, 0) && doorbell(s->ready[1]) < 0)
+      err(111, "formatter: write");
+
+    for (i = 0; i < s->nrelay; i++) {
+      if (atomic_exchange(&s->relay[i]->full, 0) &&
+          doorbell(s->relay[i]->ready[1]) < 0)
+        err(111, "formatter: write");
+    }
+  }
+}
+
+/* Wait for the formatter to write out all queued records. */
+static int formatter_join(state_t *s) {
+  int rv;
+
+  atomic_store(&s->done, 1);
+
+  if (doorbell(s->wake[1]) < 0)
+    return -1;
+
+  rv = pthread_join(s->tid, NULL);
+  if (rv != 0) {
+    errno = rv;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* HEXLOG_RELAY_THREADS: the streams of each direction are relayed by a
+ * thread running the event loop on a copy of the state. The copy shares
+ * the dump queues, the direction and the formatter through the
+ * supervisor state. The input streams precede the output streams in the
+ * stream table. */
+static int relay_init(state_t *s, hexlog_t *h) {
+  state_t *t;
+  size_t i;
+
+  for (i = 0; i < s->nstream; i += t->nstream) {
+    t = malloc(sizeof(state_t));
+    if (t == NULL)
+      return -1;
+
+    *t = *s;
+    t->h = &h[i];
+    for (t->nstream = 0; i + t->nstream < s->nstream; t->nstream++) {
+      if (h[i + t->nstream].dir != h[i].dir)
+        break;
+    }
+
+    /* signals and the child exit are handled by the supervisor */
+    t->fdsig = -1;
+    t->fdp = -1;
+    t->nrelay = 0;
+    atomic_init(&t->full, 0);
+    atomic_init(&t->req, 0);
+
+    if (pipe(t->ctl) < 0 || pipe(t->ready) < 0)
+      return -1;
+
+    if (fcntl(t->ctl[0], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(t->ctl[1], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(t->ready[0], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(t->ready[1], F_SETFL, O_NONBLOCK) < 0)
+      return -1;
+
+    t->ev = event_init(t->nstream * 3 + 4);
+    if (t->ev == NULL)
+      return -1;
+
+    s->relay[s->nrelay++] = t;
+  }
+
+  return 0;
+}
+
+static int relay_start(state_t *s) {
+  sigset_t set;
+  sigset_t oset;
+  size_t i;
+  int rv = 0;
+
+  /* signals are handled by the supervisor */
+  (void)sigfillset(&set);
+  if (pthread_sigmask(SIG_SETMASK, &set, &oset) != 0)
+    return -1;
+
+  for (i = 0; rv == 0 && i < s->nrelay; i++)
+    rv = pthread_create(&s->relay[i]->tid, NULL, relay_thread, s->relay[i]);
+
+  (void)pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+  if (rv != 0) {
+    errno = rv;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void *relay_thread(void *arg) {
+  state_t *t = arg;
+
+  if (event_loop(t, t->h) < 0)
+    err(111, "relay: %s", t->h[0].name);
+
+  return NULL;
+}
+
+/* Signal the relay threads: direction changes are read from the
+ * supervisor state. */
+static int relay_request(state_t *s, int req) {
+  size_t i;
+
+  for (i = 0; i < s->nrelay; i++) {
+    (void)atomic_fetch_or(&s->relay[i]->req, req);
+    if (doorbell(s->relay[i]->ctl[1]) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* The child has exited: wait for the relay threads to forward the
+ * remaining output. */
+static int relay_stop(state_t *s) {
+  size_t i;
+  int rv;
+
+  if (relay_request(s, RELAY_STOP) < 0)
+    return -1;
+
+  for (i = 0; i < s->nrelay; i++) {
+    rv = pthread_join(s->relay[i]->tid, NULL);
+    if (rv != 0) {
+      errno = rv;
+      return -1;
     }
-    break;
   }
 
-  if (h->off + n > 15) {
-    size_t len = ((h->off + n) / 16) * 16;
-    size_t rem = (h->off + n) % 16;
-    (void)memcpy(h->buf + h->off, buf, len);
-    if (hexdump(h->fdhex, h->label, h->buf, len, s->raw) < 0)
+  return 0;
+}
+
+/* HEXLOG_RELAY_THREADS: the main thread handles signals and the child
+ * exit. */
+static int supervise(state_t *s) {
+  event_t *ev = s->ev;
+
+  if (event_set(ev, 0, s->fdsig, POLLIN) < 0)
+    return -1;
+
+  /* POLLHUP: parent: indicate child exit */
+  if (event_set(ev, 1, s->fdp, 0) < 0)
+    return -1;
+
+  for (;;) {
+    if (event_wait(ev, -1) < 0) {
+      if (errno == EINTR)
+        continue;
       return -1;
-    if (rem > 0)
-      (void)memcpy(h->buf, buf + (len - h->off), rem);
-    h->off = rem;
-  } else {
-    (void)memcpy(h->buf + h->off, buf, n);
-    h->off += n;
+    }
+
+    if (event_revents(ev, 0) & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+      switch (sigread(s)) {
+      case 0:
+        return relay_stop(s);
+      case -1:
+        return -1;
+      case 2:
+        if (relay_request(s, RELAY_FLUSH) < 0)
+          return -1;
+        break;
+      default:
+        break;
+      }
+    }
+
+    if (event_revents(ev, 1) & POLLHUP)
+      return relay_stop(s);
   }
+}
 
-  return 1;
+static int doorbell(int fd) {
+  if (write(fd, "", 1) < 0 && errno != EAGAIN)
+    return -1;
+
+  return 0;
 }
 
-static int hexlog_write(int fd, void *buf, size_t size) {
+static int doorbell_clear(int fd) {
+  char buf[64];
   ssize_t n;
-  size_t off = 0;
 
-  do {
-    n = write(fd, buf, size - off);
+  for (;;) {
+    n = read(fd, buf, sizeof(buf));
+    if (n == 0)
+      return 0;
     if (n < 0) {
       if (errno == EINTR)
         continue;
+      return errno == EAGAIN ? 0 : -1;
+    }
+  }
+}
 
-      return -1;
+/* HEXLOG_SQUEEZE: bytes not formatted by hexdump_fmt_squeeze() advance
+ * the offset and end any run of identical lines. */
+static void squeeze_skip(hexdump_squeeze_t *sq, size_t n) {
+  if (sq == NULL)
+    return;
+
+  sq->offset += n;
+  sq->valid = 0;
+  sq->squeezed = 0;
+}
+
+/* Lines are formatted directly into the output buffer. */
+static ssize_t hexdump(outbuf_t *o, const char *label, const void *data,
+                       size_t size, int raw, hexdump_squeeze_t *sq) {
+  char out[HEXDUMP_OFFSET_MAX + HEXDUMP_LINE_MAX];
+  const unsigned char *p = data;
+  size_t labellen;
+  size_t consumed;
+  size_t n;
+
+  if (raw) {
+    return outbuf_write(o, data, size);
+  }
+
+  labellen = strlen(label);
+
+  while (size > 0) {
+    n = sq != NULL ? hexdump_fmt_squeeze(o->buf + o->len, o->size - o->len,
+                                         label, labellen, p, size,
+                                         &consumed, sq)
+                   : hexdump_fmt(o->buf + o->len, o->size - o->len, label,
+                                 labellen, p, size, &consumed);
+    o->len += n;
+
+    if (consumed == 0 && o->len > 0) {
+      /* buffer is full */
+      if (outbuf_flush(o) < 0)
+        return -1;
+      continue;
     }
-    off += n;
-  } while (off < size);
+
+    if (consumed == 0) {
+      /* label is too long to fit a line in the buffer */
+      consumed = size < 16 ? size : 16;
+      n = 0;
+      if (sq != NULL) {
+        n = hexdump_offset(out, sq->offset);
+        squeeze_skip(sq, consumed);
+      }
+      n += hexdump_line(out + n, p, consumed);
+      if (outbuf_write(o, out, n) < 0 ||
+          outbuf_write(o, label, labellen) < 0 || outbuf_write(o, "\n", 1) < 0)
+        return -1;
+    }
+    p += consumed;
+    size -= consumed;
+  }
 
   return 0;
 }
 
-static ssize_t hexdump(FILE *stream, const char *label, const void *data,
-                       size_t size, int raw) {
-  unsigned char ascii[17];
-  size_t i, j;
+/* Write a capture record. A CAPTURE_SKIPPED record has no data. */
+static int capture(state_t *s, hexlog_t *h, int type, uint64_t ts,
+                   const void *data, size_t size) {
+  unsigned char hdr[CAPTURE_HDR_SIZE];
+  capture_hdr_t rec = {0};
 
-  if (raw) {
-    return fwrite(data, 1, size, stream);
+  rec.ts = ts;
+  rec.seq = s->sup->seq++;
+  rec.len = (uint32_t)size;
+  rec.stream = (uint8_t)h->id;
+  rec.type = (uint8_t)type;
+
+  capture_encode(hdr, &rec);
+
+  if (fanout_write(h, FMT_CAPTURE, hdr, sizeof(hdr)) < 0)
+    return -1;
+
+  if (type == CAPTURE_DATA && fanout_write(h, FMT_CAPTURE, data, size) < 0)
+    return -1;
+
+  return 0;
+}
+
+/* HEXLOG_FORMAT_WORKERS: the record is split into slices of complete
+ * lines. Complete lines have a fixed length: the output of each slice
+ * is written to its offset in dst. Returns the number of characters
+ * written. */
+static size_t format_slices(state_t *s, char *dst, hexlog_t *h,
+                            const char *data, size_t len) {
+  slices_t j;
+
+  j.out = dst;
+  j.data = data;
+  j.len = len;
+  j.label = h->label;
+  j.labellen = h->labellen;
+
+  pool_run(s->pool, format_slice, &j,
+           (len + HEXLOG_SLICE_SIZE - 1) / HEXLOG_SLICE_SIZE);
+
+  return hexdump_fmt_len(len, h->labellen);
+}
+
+static void format_slice(void *arg, size_t part) {
+  slices_t *j = arg;
+  size_t off = part * HEXLOG_SLICE_SIZE;
+  size_t n = j->len - off < HEXLOG_SLICE_SIZE ? j->len - off
+                                               : HEXLOG_SLICE_SIZE;
+  size_t consumed;
+
+  (void)hexdump_fmt(j->out + hexdump_fmt_len(off, j->labellen),
+                    hexdump_fmt_len(n, j->labellen), j->label, j->labellen,
+                    j->data + off, n, &consumed);
+}
+
+/* Format a queued record as capture records: bytes dropped before the
+ * record are reported in a CAPTURE_SKIPPED record. */
+static size_t capture_fmt(char *dst, hexlog_t *h, const queue_rec_t *rec,
+                          const char *data) {
+  capture_hdr_t hdr = {0};
+  size_t off = 0;
+
+  hdr.ts = rec->ts;
+  hdr.seq = rec->seq;
+  hdr.stream = (uint8_t)h->id;
+
+  if (rec->skipped > 0) {
+    hdr.type = CAPTURE_SKIPPED;
+    hdr.len = (uint32_t)rec->skipped;
+    capture_encode((unsigned char *)dst, &hdr);
+    off += CAPTURE_HDR_SIZE;
+  }
+
+  if (rec->len > 0) {
+    hdr.type = CAPTURE_DATA;
+    hdr.len = (uint32_t)rec->len;
+    capture_encode((unsigned char *)dst + off, &hdr);
+    off += CAPTURE_HDR_SIZE;
+    (void)memcpy(dst + off, data, rec->len);
+    off += rec->len;
+  }
+
+  return off;
+}
+
+/* hexlog decode: write a capture read from stdin as a hexdump to
+ * stdout. */
+static int decode(void) {
+  unsigned char hdr[CAPTURE_HDR_SIZE];
+  char magic[CAPTURE_MAGIC_SIZE];
+  char label[32];
+  char skipped[32];
+  capture_hdr_t rec;
+  outbuf_t o;
+  char *data = NULL;
+  size_t size = 0;
+  char *p;
+  char *env;
+  size_t n;
+
+  /* stdio: the buffering mode is not selected by isatty(3) */
+  if (setvbuf(stdin, NULL, _IOFBF, BUFSIZ) < 0)
+    err(111, "setvbuf");
+
+  if (outbuf_init(&o, STDOUT_FILENO, HEXLOG_OUTPUT_SIZE) < 0)
+    err(111, "outbuf_init");
+
+  if (restrict_process() < 0)
+    err(111, "process restriction failed");
+
+  n = fread(magic, 1, sizeof(magic), stdin);
+  if (n == 0 && !ferror(stdin))
+    return 0;
+
+  if (n != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)))
+    errx(111, "decode: not a capture");
+
+  for (;;) {
+    n = fread(hdr, 1, sizeof(hdr), stdin);
+    if (n == 0 && !ferror(stdin))
+      break;
+
+    if (n != sizeof(hdr))
+      errx(111, "decode: truncated record");
+
+    capture_decode(&rec, hdr);
+
+    env = getenv(stream_var(rec.stream, "LABEL"));
+    if (env == NULL) {
+      (void)snprintf(label, sizeof(label), " (%u)", rec.stream);
+      env = label;
+    }
+
+    if (rec.type == CAPTURE_SKIPPED) {
+      n = (size_t)snprintf(skipped, sizeof(skipped), "%u bytes skipped",
+                           rec.len);
+      if (outbuf_write(&o, skipped, n) < 0 ||
+          outbuf_write(&o, env, strlen(env)) < 0 ||
+          outbuf_write(&o, "\n", 1) < 0)
+        err(111, "decode");
+      continue;
+    }
+
+    if (rec.len > size) {
+      p = realloc(data, rec.len);
+      if (p == NULL)
+        err(111, "decode");
+      data = p;
+      size = rec.len;
+    }
+
+    if (fread(data, 1, rec.len, stdin) != rec.len)
+      errx(111, "decode: truncated record");
+
+    if (rec.type != CAPTURE_DATA)
+      continue;
+
+    if (hexdump(&o, env, data, rec.len, 0, NULL) < 0)
+      err(111, "decode");
   }
 
-  ascii[16] = '\0';
-  for (i = 0; i < size; ++i) {
-    if (fprintf(stream, "%02X ", ((const unsigned char *)data)[i]) < 0)
+  if (ferror(stdin))
+    err(111, "decode");
+
+  free(data);
+
+  if (outbuf_flush(&o) < 0)
+    err(111, "decode");
+
+  return 0;
+}
+
+/* The stream table: stdin, stdout and the child file descriptors listed
+ * in HEXLOG_FDS as <fd>[:in|:out]. An output stream relays the child fd
+ * to the parent fd with the same number and an input stream relays the
+ * parent fd to the child. The input streams are listed first. */
+static int streams_init(state_t *s, hexlog_t *h, const char *spec) {
+  const char *p = spec;
+  char *end;
+  long fd;
+  int dir;
+  size_t i;
+
+  h[0].id = STDIN_FILENO;
+  h[0].dir = IN;
+  h[1].id = STDOUT_FILENO;
+  h[1].dir = OUT;
+  s->nstream = 2;
+
+  while (p != NULL && *p != '\0') {
+    errno = 0;
+    fd = strtol(p, &end, 10);
+    /* capture: the stream is stored in a byte */
+    if (errno != 0 || end == p || fd <= STDOUT_FILENO || fd > UINT8_MAX)
       return -1;
-    if (((const unsigned char *)data)[i] >= ' ' &&
-        ((const unsigned char *)data)[i] <= '~') {
-      ascii[i % 16] = ((const unsigned char *)data)[i];
-    } else {
-      ascii[i % 16] = '.';
+
+    dir = OUT;
+    if (!strncmp(end, ":in", 3)) {
+      dir = IN;
+      end += 3;
+    } else if (!strncmp(end, ":out", 4)) {
+      end += 4;
     }
-    if ((i + 1) % 8 == 0 || i + 1 == size) {
-      if (fprintf(stream, " ") < 0)
+
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return -1;
+
+    for (i = 0; i < s->nstream; i++) {
+      if (h[i].id == fd)
         return -1;
-      if ((i + 1) % 16 == 0) {
-        if (fprintf(stream, "|%s|%s\n", ascii, label) < 0)
-          return -1;
-      } else if (i + 1 == size) {
-        ascii[(i + 1) % 16] = '\0';
-        if ((i + 1) % 16 <= 8) {
-          if (fprintf(stream, " ") < 0)
-            return -1;
-        }
-        for (j = (i + 1) % 16; j < 16; ++j) {
-          if (fprintf(stream, "   ") < 0)
-            return -1;
-        }
-        if (fprintf(stream, "|%s|%s\n", ascii, label) < 0)
-          return -1;
-      }
     }
+
+    /* the parent end of the stream must be open */
+    if (s->nstream == HEXLOG_STREAM_MAX || fcntl((int)fd, F_GETFD) < 0)
+      return -1;
+
+    /* input streams precede the output streams */
+    for (i = s->nstream; dir == IN && h[i - 1].dir == OUT; i--)
+      h[i] = h[i - 1];
+
+    h[i].id = (int)fd;
+    h[i].dir = dir;
+    s->nstream++;
+
+    p = end;
+  }
+
+  return 0;
+}
+
+/* Per-stream settings: HEXLOG_<key>_STDIN, HEXLOG_<key>_STDOUT,
+ * HEXLOG_<key>_STDERR or HEXLOG_<key>_<fd>. */
+static void stream_init(state_t *s, hexlog_t *h) {
+  static const char *const std[] = {"stdin", "stdout", "stderr"};
+  const char *name;
+  char *val;
+
+  if (h->id < (int)COUNT(std))
+    (void)snprintf(h->name, sizeof(h->name), "%s", std[h->id]);
+  else
+    (void)snprintf(h->name, sizeof(h->name), "fd%d", h->id);
+
+  h->fdhex = STDERR_FILENO;
+  val = getenv(stream_var(h->id, "FD"));
+  if (val != NULL) {
+    h->fdhex = stream_fd(val);
+    if (h->fdhex < 0)
+      err(111, "%s: %s", h->name, val);
+  }
+
+  name = stream_var(h->id, "FILE");
+  val = getenv(name);
+  if (val != NULL) {
+    if (*val == '\0' || strchr(val, '/') != NULL)
+      errx(2, "%s: invalid name: %s", name, val);
+    h->file = val;
+    h->fdhex = -1;
+  }
+
+  h->fmt = s->raw ? FMT_RAW : FMT_HEX;
+  name = stream_var(h->id, "FORMAT");
+  val = getenv(name);
+  if (val != NULL) {
+    h->fmt = format(val);
+    if (h->fmt < 0)
+      errx(2, "%s: invalid format: %s", name, val);
+  }
+
+  name = stream_var(h->id, "SAMPLE");
+  val = getenv(name);
+  if (val != NULL && sample_init(&h->sample, val) < 0)
+    errx(2, "%s: invalid policy: %s", name, val);
+
+  if (h->sample.policy != SAMPLE_NONE)
+    s->sampling = 1;
+
+  name = stream_var(h->id, "SINKS");
+  val = getenv(name);
+  if (val != NULL && fanout_init(h, val) < 0)
+    errx(2, "%s: invalid sink: %s", name, val);
+
+  h->label = getenv(stream_var(h->id, "LABEL"));
+  if (h->label == NULL) {
+    (void)snprintf(h->dlabel, sizeof(h->dlabel), " (%d)", h->id);
+    h->label = h->dlabel;
+  }
+}
+
+/* Returns the name of a per-stream variable. The name is overwritten by
+ * the next call. */
+static const char *stream_var(int id, const char *key) {
+  static const char *const std[] = {"STDIN", "STDOUT", "STDERR"};
+  static char name[64];
+
+  if (id >= 0 && id < (int)COUNT(std))
+    (void)snprintf(name, sizeof(name), "HEXLOG_%s_%s", key, std[id]);
+  else
+    (void)snprintf(name, sizeof(name), "HEXLOG_%s_%d", key, id);
+
+  return name;
+}
+
+/* Returns the dump file descriptor: the descriptor must be open for
+ * writing. */
+static int stream_fd(const char *val) {
+  int fd = atoi(val);
+  int flags;
+
+  flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return -1;
+
+  if ((flags & O_ACCMODE) == O_RDONLY) {
+    errno = EBADF;
+    return -1;
+  }
+
+  return fd;
+}
+
+/* HEXLOG_SINKS: additional dump outputs of the stream as
+ * <format>:<fd>|<path>,... */
+static int fanout_init(hexlog_t *h, const char *spec) {
+  fanout_t *f;
+  char *buf;
+  char *p;
+  char *next;
+  char *target;
+
+  buf = strdup(spec);
+  if (buf == NULL)
+    err(111, "strdup");
+
+  for (p = buf; p != NULL; p = next) {
+    next = strchr(p, ',');
+    if (next != NULL)
+      *next++ = '\0';
+
+    target = strchr(p, ':');
+    if (target == NULL || target[1] == '\0' || h->nfan == HEXLOG_FANOUT_MAX)
+      return -1;
+
+    *target++ = '\0';
+
+    f = &h->fan[h->nfan++];
+    f->fmt = format(p);
+    if (f->fmt < 0)
+      return -1;
+
+    f->fd = -1;
+    f->path = NULL;
+
+    if (target[strspn(target, "0123456789")] != '\0') {
+      f->path = target;
+      continue;
+    }
+
+    f->fd = stream_fd(target);
+    if (f->fd < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Returns 1 if an output of the stream uses the format. */
+static int fanout_uses(hexlog_t *h, int fmt) {
+  size_t i;
+
+  if (h->fmt == fmt)
+    return 1;
+
+  for (i = 0; i < h->nfan; i++) {
+    if (h->fan[i].fmt == fmt)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Write formatted dump data to each output of the stream using the
+ * format. */
+static int fanout_write(hexlog_t *h, int fmt, const void *data, size_t len) {
+  size_t i;
+
+  if (h->fmt == fmt && outbuf_write(&h->sink->ob, data, len) < 0)
+    return -1;
+
+  for (i = 0; i < h->nfan; i++) {
+    if (h->fan[i].fmt == fmt &&
+        outbuf_write(&h->fan[i].sink->ob, data, len) < 0)
+      return -1;
   }
+
+  return 0;
+}
+
+/* HEXLOG_SINKS: the data is formatted once for each format used by the
+ * outputs of the stream. */
+static int fanout_dump(state_t *s, hexlog_t *h, uint64_t ts,
+                       const void *data, size_t size) {
+  const unsigned char *p = data;
+  size_t consumed;
+  size_t n;
+
+  if (fanout_uses(h, FMT_CAPTURE) &&
+      capture(s, h, CAPTURE_DATA, ts, data, size) < 0)
+    return -1;
+
+  if (fanout_write(h, FMT_RAW, data, size) < 0)
+    return -1;
+
+  if (h->fanbuf == NULL)
+    return 0;
+
+  for (; size > 0; p += consumed, size -= consumed) {
+    n = h->squeeze != NULL
+            ? hexdump_fmt_squeeze(h->fanbuf, h->fansize, h->label,
+                                  h->labellen, p, size, &consumed,
+                                  h->squeeze)
+            : hexdump_fmt(h->fanbuf, h->fansize, h->label, h->labellen, p,
+                          size, &consumed);
+    if (fanout_write(h, FMT_HEX, h->fanbuf, n) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Connect the stream to the child. The child end is returned in child. */
+static int stream_pipe(hexlog_t *h, int *child) {
+  int fds[2];
+  int parent;
+
+#ifdef HAVE_SPLICE
+  /* splice(2) requires one side of the transfer to be a pipe */
+  if (pipe(fds) < 0)
+    return -1;
+#else
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    return -1;
+#endif
+
+  parent = h->dir == IN ? fds[1] : fds[0];
+  *child = h->dir == IN ? fds[0] : fds[1];
+
+  h->fdin = h->dir == IN ? h->id : parent;
+  h->fdout = h->dir == IN ? parent : h->id;
+
+#ifdef HAVE_SPLICE
+  /* best effort: the size may exceed the limit set in
+   * /proc/sys/fs/pipe-max-size */
+  (void)fcntl(parent, F_SETPIPE_SZ, HEXLOG_PIPE_SIZE);
+#endif
+
   return 0;
 }
 
+static int format(const char *name) {
+  if (!strcmp(name, "hex"))
+    return FMT_HEX;
+  if (!strcmp(name, "raw"))
+    return FMT_RAW;
+  if (!strcmp(name, "capture"))
+    return FMT_CAPTURE;
+
+  return -1;
+}
+
 static int direction(state_t *s, char *name) {
   int d;
 
@@ -531,7 +3542,10 @@ static int direction(state_t *s, char *name) {
     d = OUT;
   else if (!strcmp(name, "inout"))
     d = IN | OUT;
-  else
+  else if (!strcmp(name, "stats") && !s->raw) {
+    d = NONE;
+    s->traffic = 1;
+  } else
     return -1;
 
   s->dir_initial = d;
@@ -543,7 +3557,9 @@ static int direction(state_t *s, char *name) {
 static noreturn void usage(void) {
   (void)fprintf(stderr,
                 "%s %s (using %s mode process restriction)\n"
-                "usage: %s <in|out|inout|none> <cmd> <...>\n",
-                __progname, HEXLOG_VERSION, RESTRICT_PROCESS, __progname);
+                "usage: %s <in|out|inout|none|stats> <cmd> <...>\n"
+                "       %s decode\n",
+                __progname, HEXLOG_VERSION, RESTRICT_PROCESS, __progname,
+                __progname);
   exit(2);
 }
@@ -0,0 +1,282 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+
+/* The patterns are compiled to a DFA: each state has a transition for
+ * every byte value. State 0 is the root. out[state] is the length of the
+ * longest pattern ending at the state or 0. */
+struct match {
+  uint32_t (*next)[256];
+  size_t *out;
+  uint32_t *fail;
+  size_t nstate;
+  size_t cap;
+  size_t maxlen;
+  int first; /* the only byte starting a pattern or -1 */
+};
+
+static int match_grow(match_t *m);
+
+match_t *match_init(void) {
+  match_t *m;
+
+  m = calloc(1, sizeof(match_t));
+  if (m == NULL)
+    return NULL;
+
+  if (match_grow(m) < 0) {
+    free(m);
+    return NULL;
+  }
+
+  m->nstate = 1;
+  m->first = -1;
+
+  return m;
+}
+
+/* Add a pattern to the trie. Transitions not in the trie are 0 until
+ * match_compile(). */
+int match_add(match_t *m, const void *pattern, size_t len) {
+  const unsigned char *p = pattern;
+  uint32_t state = 0;
+  size_t i;
+
+  if (len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (m->next[state][p[i]] == 0) {
+      if (m->nstate == m->cap && match_grow(m) < 0)
+        return -1;
+      m->next[state][p[i]] = (uint32_t)m->nstate++;
+    }
+    state = m->next[state][p[i]];
+  }
+
+  if (len > m->out[state])
+    m->out[state] = len;
+
+  if (len > m->maxlen)
+    m->maxlen = len;
+
+  return 0;
+}
+
+/* Add a list of patterns separated by '|'. Escapes: \\, \|, \n, \r, \t
+ * and \xHH. */
+int match_parse(match_t *m, const char *spec) {
+  char *buf;
+  const char *p;
+  size_t len = 0;
+  char hex[3] = {0};
+  int rv = 0;
+
+  buf = malloc(strlen(spec) + 1);
+  if (buf == NULL)
+    return -1;
+
+  for (p = spec;; p++) {
+    if (*p == '\0' || *p == '|') {
+      rv = match_add(m, buf, len);
+      if (rv < 0 || *p == '\0')
+        break;
+      len = 0;
+      continue;
+    }
+
+    if (*p != '\\') {
+      buf[len++] = *p;
+      continue;
+    }
+
+    switch (*++p) {
+    case '\\':
+    case '|':
+      buf[len++] = *p;
+      break;
+    case 'n':
+      buf[len++] = '\n';
+      break;
+    case 'r':
+      buf[len++] = '\r';
+      break;
+    case 't':
+      buf[len++] = '\t';
+      break;
+    case 'x':
+      if (!isxdigit((unsigned char)p[1]) || !isxdigit((unsigned char)p[2])) {
+        errno = EINVAL;
+        rv = -1;
+        break;
+      }
+      hex[0] = p[1];
+      hex[1] = p[2];
+      buf[len++] = (char)strtoul(hex, NULL, 16);
+      p += 2;
+      break;
+    default:
+      errno = EINVAL;
+      rv = -1;
+      break;
+    }
+
+    if (rv < 0)
+      break;
+  }
+
+  free(buf);
+  return rv;
+}
+
+/* Compute the failure links in breadth first order and replace the
+ * missing transitions by the transitions of the failure state. */
+int match_compile(match_t *m) {
+  uint32_t *queue;
+  size_t head = 0;
+  size_t tail = 0;
+  uint32_t state;
+  uint32_t child;
+  int c;
+
+  queue = malloc(m->nstate * sizeof(uint32_t));
+  if (queue == NULL)
+    return -1;
+
+  for (c = 0; c < 256; c++) {
+    child = m->next[0][c];
+    if (child == 0)
+      continue;
+
+    m->fail[child] = 0;
+    queue[tail++] = child;
+
+    m->first = m->first == -1 ? c : -2;
+  }
+
+  if (m->first < 0)
+    m->first = -1;
+
+  while (head < tail) {
+    state = queue[head++];
+
+    /* a pattern ending at the failure state is a suffix */
+    if (m->out[m->fail[state]] > m->out[state])
+      m->out[state] = m->out[m->fail[state]];
+
+    for (c = 0; c < 256; c++) {
+      child = m->next[state][c];
+      if (child == 0) {
+        m->next[state][c] = m->next[m->fail[state]][c];
+        continue;
+      }
+
+      m->fail[child] = m->next[m->fail[state]][c];
+      queue[tail++] = child;
+    }
+  }
+
+  free(queue);
+  return 0;
+}
+
+size_t match_maxlen(const match_t *m) { return m->maxlen; }
+
+/* Scan data for the first pattern match. Returns the offset following
+ * the end of the match and the length of the pattern in len, or 0 if no
+ * pattern matched. */
+size_t match_scan(const match_t *m, unsigned int *state, const void *data,
+                  size_t size, size_t *len) {
+  const unsigned char *p = data;
+  const unsigned char *q;
+  uint32_t st = *state;
+  size_t i = 0;
+
+  while (i < size) {
+    /* skip bytes not starting a pattern: the loads are independent */
+    if (st == 0) {
+      if (m->first >= 0) {
+        q = memchr(p + i, m->first, size - i);
+        if (q == NULL)
+          break;
+        i = (size_t)(q - p);
+      } else {
+        while (i < size && m->next[0][p[i]] == 0)
+          i++;
+        if (i == size)
+          break;
+      }
+    }
+
+    st = m->next[st][p[i++]];
+
+    if (m->out[st] > 0) {
+      *state = st;
+      *len = m->out[st];
+      return i;
+    }
+  }
+
+  *state = st;
+  return 0;
+}
+
+void match_free(match_t *m) {
+  if (m == NULL)
+    return;
+
+  free(m->next);
+  free(m->out);
+  free(m->fail);
+  free(m);
+}
+
+static int match_grow(match_t *m) {
+  uint32_t(*next)[256];
+  size_t *out;
+  uint32_t *fail;
+  size_t cap = m->cap == 0 ? 16 : m->cap * 2;
+
+  next = realloc(m->next, cap * sizeof(*next));
+  if (next == NULL)
+    return -1;
+  m->next = next;
+
+  out = realloc(m->out, cap * sizeof(*out));
+  if (out == NULL)
+    return -1;
+  m->out = out;
+
+  fail = realloc(m->fail, cap * sizeof(*fail));
+  if (fail == NULL)
+    return -1;
+  m->fail = fail;
+
+  (void)memset(m->next + m->cap, 0, (cap - m->cap) * sizeof(*next));
+  (void)memset(m->out + m->cap, 0, (cap - m->cap) * sizeof(*out));
+  (void)memset(m->fail + m->cap, 0, (cap - m->cap) * sizeof(*fail));
+
+  m->cap = cap;
+
+  return 0;
+}
@@ -0,0 +1,28 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+
+/* Streaming multi-pattern matcher (Aho-Corasick). The matcher state is
+ * kept by the caller: a match may span calls to match_scan(). */
+typedef struct match match_t;
+
+match_t *match_init(void);
+int match_add(match_t *m, const void *pattern, size_t len);
+int match_parse(match_t *m, const char *spec);
+int match_compile(match_t *m);
+size_t match_maxlen(const match_t *m);
+size_t match_scan(const match_t *m, unsigned int *state, const void *data,
+                  size_t size, size_t *len);
+void match_free(match_t *m);
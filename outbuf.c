@@ -0,0 +1,104 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
+
+int outbuf_init(outbuf_t *o, int fd, size_t size) {
+  o->buf = malloc(size);
+  if (o->buf == NULL)
+    return -1;
+
+  o->fd = fd;
+  o->size = size;
+  o->len = 0;
+
+  return 0;
+}
+
+/* Append data to the buffer. If the data does not fit, the buffer and
+ * the data are written in a single writev(2): large writes are not
+ * copied. */
+int outbuf_write(outbuf_t *o, const void *data, size_t len) {
+  struct iovec iov[2];
+
+  if (len <= o->size - o->len) {
+    (void)memcpy(o->buf + o->len, data, len);
+    o->len += len;
+    return 0;
+  }
+
+  iov[0].iov_base = o->buf;
+  iov[0].iov_len = o->len;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = len;
+
+  o->len = 0;
+
+  return writev_all(o->fd, iov, 2);
+}
+
+int outbuf_flush(outbuf_t *o) {
+  struct iovec iov;
+
+  if (o->len == 0)
+    return 0;
+
+  iov.iov_base = o->buf;
+  iov.iov_len = o->len;
+
+  o->len = 0;
+
+  return writev_all(o->fd, &iov, 1);
+}
+
+/* Write all of the vector: a non-blocking descriptor is polled until
+ * writable. */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+  struct pollfd pfd = {0};
+  ssize_t n;
+
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+
+  while (iovcnt > 0) {
+    n = writev(fd, iov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return -1;
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return -1;
+      continue;
+    }
+
+    for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+      n -= iov->iov_len;
+
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+/* The caller of pool_run() runs parts alongside the workers and returns
+ * when all parts are complete. A job is published by incrementing gen:
+ * a worker runs parts until none are left, then waits for the next
+ * generation. Jobs are submitted by one thread at a time. */
+
+struct pool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* workers: a job was published */
+  pthread_cond_t finish; /* caller: the last part completed */
+  size_t gen;
+  pool_fn fn;
+  void *arg;
+  size_t nparts;
+  size_t next; /* next part to run */
+  size_t done; /* parts completed */
+};
+
+static void *pool_worker(void *arg);
+static void pool_parts(pool_t *p);
+
+pool_t *pool_init(size_t nworker) {
+  pool_t *p;
+  pthread_t tid;
+  sigset_t set;
+  sigset_t oset;
+  size_t i;
+  int rv = 0;
+
+  p = calloc(1, sizeof(pool_t));
+  if (p == NULL)
+    return NULL;
+
+  if (pthread_mutex_init(&p->lock, NULL) != 0 ||
+      pthread_cond_init(&p->start, NULL) != 0 ||
+      pthread_cond_init(&p->finish, NULL) != 0)
+    return NULL;
+
+  /* signals are handled by the main thread */
+  (void)sigfillset(&set);
+  if (pthread_sigmask(SIG_SETMASK, &set, &oset) != 0)
+    return NULL;
+
+  for (i = 0; rv == 0 && i < nworker; i++) {
+    rv = pthread_create(&tid, NULL, pool_worker, p);
+    if (rv == 0)
+      (void)pthread_detach(tid);
+  }
+
+  (void)pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+  if (rv != 0) {
+    errno = rv;
+    return NULL;
+  }
+
+  return p;
+}
+
+void pool_run(pool_t *p, pool_fn fn, void *arg, size_t nparts) {
+  (void)pthread_mutex_lock(&p->lock);
+
+  p->fn = fn;
+  p->arg = arg;
+  p->nparts = nparts;
+  p->next = 0;
+  p->done = 0;
+  p->gen++;
+  (void)pthread_cond_broadcast(&p->start);
+
+  pool_parts(p);
+
+  while (p->done < p->nparts)
+    (void)pthread_cond_wait(&p->finish, &p->lock);
+
+  (void)pthread_mutex_unlock(&p->lock);
+}
+
+static void *pool_worker(void *arg) {
+  pool_t *p = arg;
+  size_t gen = 0;
+
+  (void)pthread_mutex_lock(&p->lock);
+
+  for (;;) {
+    while (p->gen == gen)
+      (void)pthread_cond_wait(&p->start, &p->lock);
+
+    gen = p->gen;
+    pool_parts(p);
+  }
+
+  return NULL;
+}
+
+/* Run parts of the current job until none are left. Called with the lock
+ * held. */
+static void pool_parts(pool_t *p) {
+  size_t part;
+
+  while (p->next < p->nparts) {
+    part = p->next++;
+
+    (void)pthread_mutex_unlock(&p->lock);
+    p->fn(p->arg, part);
+    (void)pthread_mutex_lock(&p->lock);
+
+    if (++p->done == p->nparts)
+      (void)pthread_cond_signal(&p->finish);
+  }
+}
@@ -0,0 +1,179 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+
+/* Bounded queue of dump records.
+ *
+ * Records are stored in a ring buffer as a queue_rec_t header followed by
+ * the data. head and tail increase monotonically: the offset into the
+ * buffer is taken modulo the size.
+ *
+ * The queue is lock-free for one producer and one consumer. The producer
+ * owns tail and the consumer owns head, except for the drop-oldest
+ * policy: the producer discards records by advancing head. Both sides
+ * advance head with a compare-and-swap. The consumer copies a record
+ * before claiming it: if the claim fails, the record was discarded and
+ * the copy may have been overwritten. */
+
+static void ring_write(queue_t *q, size_t off, const void *src, size_t len);
+static void ring_read(const queue_t *q, size_t off, void *dst, size_t len);
+
+int queue_init(queue_t *q, size_t size, int policy) {
+  q->buf = malloc(size);
+  if (q->buf == NULL)
+    return -1;
+
+  q->size = size;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->skipped = 0;
+  atomic_init(&q->lost, 0);
+  q->policy = policy;
+
+  return 0;
+}
+
+int queue_policy(const char *name) {
+  if (!strcmp(name, "block"))
+    return QUEUE_BLOCK;
+  if (!strcmp(name, "drop-newest"))
+    return QUEUE_DROP_NEWEST;
+  if (!strcmp(name, "drop-oldest"))
+    return QUEUE_DROP_OLDEST;
+
+  return -1;
+}
+
+size_t queue_free(queue_t *q) {
+  return q->size - (atomic_load_explicit(&q->tail, memory_order_relaxed) -
+                    atomic_load_explicit(&q->head, memory_order_acquire));
+}
+
+/* Producer: no records are queued and no bytes were dropped. */
+int queue_empty(queue_t *q) {
+  return !queue_pending(q) && q->skipped == 0 &&
+         atomic_load_explicit(&q->lost, memory_order_relaxed) == 0;
+}
+
+/* Returns 1 if records are waiting for the consumer. */
+int queue_pending(queue_t *q) {
+  return atomic_load_explicit(&q->head, memory_order_acquire) !=
+         atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+/* Append a record. If the queue is full, the overflow policy is applied.
+ * The block policy is enforced by the caller: the caller stops reading
+ * until queue_free() has space for the record.
+ *
+ * Returns 0 if the record was queued or 1 if the record was dropped. A
+ * record with no data holds bytes dropped before a flush. */
+int queue_push(queue_t *q, size_t seq, uint64_t ts, const void *data,
+               size_t len) {
+  queue_rec_t rec;
+  size_t need = QUEUE_RECSZ(len);
+  size_t head;
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  if (need > q->size) {
+    q->skipped += len;
+    return 1;
+  }
+
+  while (queue_free(q) < need) {
+    if (q->policy != QUEUE_DROP_OLDEST) {
+      q->skipped += len;
+      return 1;
+    }
+
+    /* the record header is not modified until head is advanced */
+    head = atomic_load_explicit(&q->head, memory_order_acquire);
+    ring_read(q, head, &rec, sizeof(rec));
+    if (atomic_compare_exchange_strong(&q->head, &head,
+                                       head + QUEUE_RECSZ(rec.len)))
+      atomic_fetch_add(&q->lost, rec.skipped + rec.len);
+  }
+
+  rec.seq = seq;
+  rec.ts = ts;
+  rec.len = len;
+  rec.skipped = q->skipped;
+  q->skipped = 0;
+
+  ring_write(q, tail, &rec, sizeof(rec));
+  ring_write(q, tail + sizeof(rec), data, len);
+  atomic_store_explicit(&q->tail, tail + need, memory_order_release);
+
+  return 0;
+}
+
+/* Returns 1 and the header of the oldest record or 0 if the queue is
+ * empty. */
+int queue_peek(queue_t *q, queue_rec_t *rec) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+  if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+    return 0;
+
+  ring_read(q, head, rec, sizeof(*rec));
+  return 1;
+}
+
+/* Remove the oldest record. The data is copied to a buffer of at least
+ * rec->len bytes. Bytes dropped from the head of the queue are reported
+ * in the skipped field of the record. */
+int queue_pop(queue_t *q, queue_rec_t *rec, void *data, size_t size) {
+  size_t head;
+
+  for (;;) {
+    head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+      return 0;
+
+    ring_read(q, head, rec, sizeof(*rec));
+
+    if (rec->len <= size)
+      ring_read(q, head + sizeof(*rec), data, rec->len);
+
+    if (atomic_compare_exchange_strong(&q->head, &head,
+                                       head + QUEUE_RECSZ(rec->len)))
+      break;
+  }
+
+  if (rec->len > size)
+    return -1;
+
+  rec->skipped += atomic_exchange(&q->lost, 0);
+
+  return 1;
+}
+
+static void ring_write(queue_t *q, size_t off, const void *src, size_t len) {
+  size_t i = off % q->size;
+  size_t n = len < q->size - i ? len : q->size - i;
+
+  (void)memcpy(q->buf + i, src, n);
+  (void)memcpy(q->buf, (const char *)src + n, len - n);
+}
+
+static void ring_read(const queue_t *q, size_t off, void *dst, size_t len) {
+  size_t i = off % q->size;
+  size_t n = len < q->size - i ? len : q->size - i;
+
+  (void)memcpy(dst, q->buf + i, n);
+  (void)memcpy((char *)dst + n, q->buf, len - n);
+}
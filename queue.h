@@ -0,0 +1,55 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* overflow policy */
+enum {
+  QUEUE_BLOCK = 1,
+  QUEUE_DROP_NEWEST = 2,
+  QUEUE_DROP_OLDEST = 3,
+};
+
+typedef struct {
+  size_t seq;     /* ordering of records across queues */
+  uint64_t ts;    /* time the record was queued */
+  size_t len;     /* size of the record data */
+  size_t skipped; /* bytes dropped before this record */
+} queue_rec_t;
+
+/* single producer, single consumer: the producer may run concurrently
+ * with the consumer */
+typedef struct {
+  char *buf;
+  size_t size;
+  atomic_size_t head; /* offset of the oldest record */
+  atomic_size_t tail; /* offset of the next record */
+  size_t skipped;     /* producer: bytes dropped since the last record */
+  atomic_size_t lost; /* drop-oldest: bytes dropped from the head */
+  int policy;
+} queue_t;
+
+#define QUEUE_RECSZ(_len) (sizeof(queue_rec_t) + (_len))
+
+int queue_init(queue_t *q, size_t size, int policy);
+int queue_policy(const char *name);
+size_t queue_free(queue_t *q);
+int queue_empty(queue_t *q);
+int queue_pending(queue_t *q);
+int queue_push(queue_t *q, size_t seq, uint64_t ts, const void *data,
+               size_t len);
+int queue_peek(queue_t *q, queue_rec_t *rec);
+int queue_pop(queue_t *q, queue_rec_t *rec, void *data, size_t size);
@@ -12,6 +12,12 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+/* open(2) flags of the files created in the directory passed to
+ * restrict_process_dir(): new files, write only */
+#define RESTRICT_PROCESS_DIR_FLAGS (O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC)
+
 int restrict_process_init(void);
 int restrict_process(void);
+int restrict_process_dir(const char *path, int fd);
+int restrict_process_file(int fd);
 int restrict_process_signal_on_supervisor_exit(void);
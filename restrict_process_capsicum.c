@@ -31,6 +31,12 @@ static int fdlimit(int lowfd, cap_rights_t *policy);
 static int isnum(const char *s);
 static int fdlimit_range(int lowfd, cap_rights_t *policy);
 
+/* HEXLOG_DIR: files are created in the directory */
+static int restrict_dirfd = -1;
+
+/* HEXLOG_SINKS: files opened before the restrictions are applied */
+static int restrict_files;
+
 int restrict_process_init(void) { return 0; }
 
 int restrict_process_signal_on_supervisor_exit(void) { return 0; }
@@ -39,20 +45,25 @@ int restrict_process(void) {
   cap_rights_t policy_read;
   cap_rights_t policy_write;
   cap_rights_t policy_rw;
+  cap_rights_t policy_dir;
   struct rlimit rl = {0};
   struct stat sb = {0};
 
   if (fstat(STDOUT_FILENO, &sb) < 0)
     return -1;
 
-  if (!S_ISREG(sb.st_mode)) {
+  if (!S_ISREG(sb.st_mode) && restrict_dirfd == -1 && !restrict_files) {
     if (setrlimit(RLIMIT_FSIZE, &rl) < 0)
       return -1;
   }
 
-  (void)cap_rights_init(&policy_read, CAP_READ, CAP_EVENT);
-  (void)cap_rights_init(&policy_write, CAP_WRITE, CAP_EVENT);
-  (void)cap_rights_init(&policy_rw, CAP_READ, CAP_WRITE, CAP_EVENT, CAP_PDKILL);
+  (void)cap_rights_init(&policy_read, CAP_READ, CAP_EVENT, CAP_FCNTL);
+  (void)cap_rights_init(&policy_write, CAP_WRITE, CAP_EVENT, CAP_FCNTL);
+  (void)cap_rights_init(&policy_rw, CAP_READ, CAP_WRITE, CAP_EVENT, CAP_FCNTL,
+                        CAP_PDKILL);
+  /* files opened using the directory inherit the rights */
+  (void)cap_rights_init(&policy_dir, CAP_LOOKUP, CAP_CREATE, CAP_WRITE,
+                        CAP_SEEK, CAP_FSTAT, CAP_EVENT, CAP_FCNTL);
 
   if (cap_rights_limit(STDIN_FILENO, &policy_read) < 0)
     return -1;
@@ -63,12 +74,28 @@ int restrict_process(void) {
   if (cap_rights_limit(STDERR_FILENO, &policy_write) < 0)
     return -1;
 
+  if (restrict_dirfd != -1 &&
+      cap_rights_limit(restrict_dirfd, &policy_dir) < 0)
+    return -1;
+
   if (fdlimit(STDERR_FILENO + 1, &policy_rw) < 0)
     return -1;
 
   return cap_enter();
 }
 
+int restrict_process_dir(const char *path, int fd) {
+  (void)path;
+  restrict_dirfd = fd;
+  return 0;
+}
+
+int restrict_process_file(int fd) {
+  (void)fd;
+  restrict_files = 1;
+  return 0;
+}
+
 static int fdlimit(int lowfd, cap_rights_t *policy) {
   DIR *dp;
   int dfd;
@@ -92,7 +119,7 @@ static int fdlimit(int lowfd, cap_rights_t *policy) {
 
     fd = atoi(de->d_name);
 
-    if (fd < lowfd || fd == dfd)
+    if (fd < lowfd || fd == dfd || fd == restrict_dirfd)
       continue;
 
     if (cap_rights_limit(fd, policy) < 0) {
@@ -125,7 +152,7 @@ static int fdlimit_range(int lowfd, cap_rights_t *policy) {
     return -1;
 
   for (fd = rl.rlim_cur; fd >= lowfd; fd--) {
-    if (fcntl(fd, F_GETFD, 0) == -1)
+    if (fd == restrict_dirfd || fcntl(fd, F_GETFD, 0) == -1)
       continue;
 
     if (cap_rights_limit(fd, policy) < 0)
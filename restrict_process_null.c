@@ -17,4 +17,15 @@
 int restrict_process_signal_on_supervisor_exit(void) { return 0; }
 int restrict_process_init(void) { return 0; }
 int restrict_process(void) { return 0; }
+
+int restrict_process_dir(const char *path, int fd) {
+  (void)path;
+  (void)fd;
+  return 0;
+}
+
+int restrict_process_file(int fd) {
+  (void)fd;
+  return 0;
+}
 #endif
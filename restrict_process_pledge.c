@@ -14,9 +14,58 @@
  */
 #include "restrict_process.h"
 #ifdef RESTRICT_PROCESS_pledge
+#include <string.h>
 #include <unistd.h>
 
+extern char **environ;
+
+/* HEXLOG_DIR: files are created in the directory */
+static const char *restrict_dir;
+
 int restrict_process_signal_on_supervisor_exit(void) { return 0; }
-int restrict_process_init(void) { return pledge("exec proc stdio", NULL); }
-int restrict_process(void) { return pledge("proc stdio", NULL); }
+
+/* Returns 1 if dump files are opened: HEXLOG_DIR, HEXLOG_FILE_* or
+ * HEXLOG_SINKS_* */
+static int restrict_files(void) {
+  char **e;
+
+  for (e = environ; *e != NULL; e++) {
+    if (!strncmp(*e, "HEXLOG_DIR=", 11) || !strncmp(*e, "HEXLOG_FILE_", 12) ||
+        !strncmp(*e, "HEXLOG_SINKS_", 13))
+      return 1;
+  }
+
+  return 0;
+}
+
+/* rpath, wpath, cpath, unveil: dump files are opened after startup */
+int restrict_process_init(void) {
+  return pledge(restrict_files() ? "exec proc stdio rpath wpath cpath unveil"
+                                 : "exec proc stdio",
+                NULL);
+}
+
+int restrict_process(void) {
+  if (restrict_dir == NULL)
+    return pledge("proc stdio", NULL);
+
+  if (unveil(restrict_dir, "cw") < 0)
+    return -1;
+
+  if (unveil(NULL, NULL) < 0)
+    return -1;
+
+  return pledge("proc stdio wpath cpath", NULL);
+}
+
+int restrict_process_dir(const char *path, int fd) {
+  (void)fd;
+  restrict_dir = path;
+  return 0;
+}
+
+int restrict_process_file(int fd) {
+  (void)fd;
+  return 0;
+}
 #endif
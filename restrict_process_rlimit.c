@@ -24,6 +24,12 @@ int restrict_process_signal_on_supervisor_exit(void) { return 0; }
 
 int restrict_process_init(void) { return 0; }
 
+/* HEXLOG_DIR: files are created in the directory */
+static int restrict_dirfd = -1;
+
+/* HEXLOG_SINKS: files opened before the restrictions are applied */
+static int restrict_files;
+
 int restrict_process(void) {
   struct rlimit rl_zero = {0};
   struct stat sb;
@@ -31,11 +37,23 @@ int restrict_process(void) {
   if (fstat(STDOUT_FILENO, &sb) < 0)
     return -1;
 
-  if (!S_ISREG(sb.st_mode)) {
+  if (!S_ISREG(sb.st_mode) && restrict_dirfd == -1 && !restrict_files) {
     if (setrlimit(RLIMIT_FSIZE, &rl_zero) < 0)
       return -1;
   }
 
   return setrlimit(RLIMIT_NPROC, &rl_zero);
 }
+
+int restrict_process_dir(const char *path, int fd) {
+  (void)path;
+  restrict_dirfd = fd;
+  return 0;
+}
+
+int restrict_process_file(int fd) {
+  (void)fd;
+  restrict_files = 1;
+  return 0;
+}
 #endif
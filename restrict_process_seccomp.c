@@ -12,12 +12,18 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#ifdef __linux__
+#define _GNU_SOURCE /* O_LARGEFILE */
+#endif
+
 #include "restrict_process.h"
 #ifdef RESTRICT_PROCESS_seccomp
 #include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 
 #include <linux/audit.h>
 #include <linux/filter.h>
@@ -52,6 +58,21 @@
                                       it in accumulator */                     \
       BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr))
 
+/* openat(2) of a new file in the directory: a syscall number of -1 never
+ * matches. The path is not checked: absolute paths ignore the directory
+ * descriptor. O_LARGEFILE may be added by the C library. */
+#define SC_ALLOW_OPENAT(_nr, _dirfd, _flags)                                   \
+  BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (_nr), 0, 7),                            \
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS,                                       \
+               offsetof(struct seccomp_data, args[0])),                        \
+      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (_dirfd), 0, 4),                     \
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS,                                       \
+               offsetof(struct seccomp_data, args[2])),                        \
+      BPF_STMT(BPF_ALU + BPF_AND + BPF_K, ~(__u32)O_LARGEFILE),                \
+      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (_flags), 0, 1),                     \
+      BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),                            \
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr))
+
 /*
  * http://outflux.net/teach-seccomp/
  * https://github.com/gebi/teach-seccomp
@@ -79,7 +100,25 @@ int restrict_process_signal_on_supervisor_exit(void) {
 
 int restrict_process_init(void) { return 0; }
 
+/* HEXLOG_DIR: files are created in the directory */
+static int restrict_dirfd = -1;
+
+int restrict_process_dir(const char *path, int fd) {
+  (void)path;
+  restrict_dirfd = fd;
+  return 0;
+}
+
+int restrict_process_file(int fd) {
+  (void)fd;
+  return 0;
+}
+
 int restrict_process(void) {
+#ifdef __NR_openat
+  /* HEXLOG_DIR: openat(2) is allowed only if a directory is set */
+  const __u32 openat_nr = restrict_dirfd < 0 ? (__u32)-1 : __NR_openat;
+#endif
   struct sock_filter filter[] = {
       /* Ensure the syscall arch convention is as expected. */
       BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, arch)),
@@ -94,6 +133,23 @@ int restrict_process(void) {
 #ifdef __NR_close
       SC_ALLOW(close),
 #endif
+#ifdef __NR_fcntl
+      SC_ALLOW(fcntl),
+#endif
+#ifdef __NR_fcntl64
+      SC_ALLOW(fcntl64),
+#endif
+#ifdef EVENT_epoll
+#ifdef __NR_epoll_ctl
+      SC_ALLOW(epoll_ctl),
+#endif
+#ifdef __NR_epoll_pwait
+      SC_ALLOW(epoll_pwait),
+#endif
+#ifdef __NR_epoll_wait
+      SC_ALLOW(epoll_wait),
+#endif
+#endif
 #ifdef __NR_poll
       SC_ALLOW(poll),
 #endif
@@ -118,6 +174,12 @@ int restrict_process(void) {
 #ifdef __NR_readv
       SC_ALLOW(readv),
 #endif
+#ifdef __NR_splice
+      SC_ALLOW(splice),
+#endif
+#ifdef __NR_tee
+      SC_ALLOW(tee),
+#endif
 
 #ifdef __NR_mmap
       SC_ALLOW(mmap),
@@ -144,6 +206,23 @@ int restrict_process(void) {
       SC_ALLOW(exit_group),
 #endif
 
+  /* HEXLOG_THREAD: formatter thread */
+#ifdef __NR_exit
+      SC_ALLOW(exit),
+#endif
+#ifdef __NR_futex
+      SC_ALLOW(futex),
+#endif
+#ifdef __NR_rseq
+      SC_ALLOW(rseq),
+#endif
+#ifdef __NR_rt_sigprocmask
+      SC_ALLOW(rt_sigprocmask),
+#endif
+#ifdef __NR_set_robust_list
+      SC_ALLOW(set_robust_list),
+#endif
+
   /* /etc/localtime */
 #ifdef __NR_fstat
       SC_ALLOW(fstat),
@@ -169,14 +248,18 @@ int restrict_process(void) {
       SC_ALLOW(writev),
 #endif
 
-#ifdef __NR_restart_syscall
-      SC_ALLOW(restart_syscall),
+#ifdef __NR_clock_gettime
+      SC_ALLOW(clock_gettime),
 #endif
-#ifdef __NR_alarm
-      SC_ALLOW(alarm),
+#ifdef __NR_clock_gettime64
+      SC_ALLOW(clock_gettime64),
 #endif
-#ifdef __NR_setitimer
-      SC_ALLOW(setitimer),
+
+  /* signal handlers: signals are read from a signalfd(2) by the epoll
+   * backend */
+#ifndef EVENT_epoll
+#ifdef __NR_restart_syscall
+      SC_ALLOW(restart_syscall),
 #endif
 #ifdef __NR_rt_sigreturn
       SC_ALLOW(rt_sigreturn),
@@ -184,6 +267,16 @@ int restrict_process(void) {
 #ifdef __NR_sigreturn
       SC_ALLOW(sigreturn),
 #endif
+#endif
+
+  /* HEXLOG_DIR: rotate dump files */
+#ifdef __NR_openat
+      SC_ALLOW_OPENAT(openat_nr, (__u32)restrict_dirfd,
+                      RESTRICT_PROCESS_DIR_FLAGS),
+#endif
+#ifdef __NR_fallocate
+      SC_ALLOW(fallocate),
+#endif
 
 #ifdef __NR_wait4
       SC_ALLOW(wait4),
@@ -203,6 +296,16 @@ int restrict_process(void) {
   if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
     return -1;
 
+#if defined(__NR_seccomp) && defined(SECCOMP_FILTER_FLAG_TSYNC)
+  /* apply the filter to all threads */
+  if (syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+              SECCOMP_FILTER_FLAG_TSYNC, &prog) == 0)
+    return 0;
+
+  if (errno != ENOSYS)
+    return -1;
+#endif
+
   return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
 }
 #endif
@@ -0,0 +1,81 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "restrict_process.h"
+#include "rotate.h"
+
+/* Create the next file. Returns the file descriptor. */
+int rotate_open(rotate_t *r, int64_t now) {
+  char path[256];
+  char ts[32];
+  struct tm tm;
+  time_t t;
+  int n;
+  int fd;
+
+  t = time(NULL);
+  if (gmtime_r(&t, &tm) == NULL)
+    return -1;
+
+  if (strftime(ts, sizeof(ts), "%Y%m%dT%H%M%SZ", &tm) == 0)
+    return -1;
+
+  for (;;) {
+    n = snprintf(path, sizeof(path), "%s.%s.%04u", r->name, ts, r->seq++);
+    if (n < 0 || (size_t)n >= sizeof(path)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    fd = openat(r->dirfd, path, RESTRICT_PROCESS_DIR_FLAGS, 0600);
+    if (fd != -1)
+      break;
+
+    if (errno != EEXIST)
+      return -1;
+  }
+
+#ifdef FALLOC_FL_KEEP_SIZE
+  /* best effort: reserve the blocks for the file without changing the
+   * file size */
+  if (r->size > 0)
+    (void)fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)r->size);
+#endif
+
+  r->written = 0;
+  r->opened = now;
+
+  return fd;
+}
+
+/* Returns 1 if the current file has reached a limit. */
+int rotate_due(const rotate_t *r, int64_t now) {
+  if (r->size > 0 && r->written >= r->size)
+    return 1;
+
+  if (r->age > 0 && now - r->opened >= r->age)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dump files created in a directory: a new file is started when the
+ * current file reaches the size or age limit. */
+typedef struct {
+  int dirfd;
+  const char *name; /* files are named <name>.<UTC time>.<n> */
+  size_t size;      /* 0: no size limit */
+  int64_t age;      /* ms, 0: no age limit */
+  size_t written;
+  int64_t opened;
+  unsigned int seq;
+} rotate_t;
+
+int rotate_open(rotate_t *r, int64_t now);
+int rotate_due(const rotate_t *r, int64_t now);
@@ -0,0 +1,116 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample.h"
+
+/* burst: default idle time between bursts */
+#define SAMPLE_BURST_GAP 100
+
+static int sample_arg(const char *s, char **endp, size_t *arg);
+
+/* Parse a sampling policy: burst:<bytes>[:<gap ms>], rate:<bytes/s> or
+ * chunk:<k>. */
+int sample_init(sample_t *sp, const char *spec) {
+  char *p;
+  size_t gap = SAMPLE_BURST_GAP;
+
+  (void)memset(sp, 0, sizeof(sample_t));
+
+  if (!strncmp(spec, "burst:", 6)) {
+    sp->policy = SAMPLE_BURST;
+    if (sample_arg(spec + 6, &p, &sp->arg) < 0)
+      return -1;
+    if (*p == ':' && sample_arg(p + 1, &p, &gap) < 0)
+      return -1;
+  } else if (!strncmp(spec, "rate:", 5)) {
+    sp->policy = SAMPLE_RATE;
+    if (sample_arg(spec + 5, &p, &sp->arg) < 0)
+      return -1;
+    sp->tokens = sp->arg * 1000;
+  } else if (!strncmp(spec, "chunk:", 6)) {
+    sp->policy = SAMPLE_CHUNK;
+    if (sample_arg(spec + 6, &p, &sp->arg) < 0 || sp->arg == 0)
+      return -1;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (*p != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  sp->gap = (int64_t)gap;
+  sp->last = -1;
+
+  return 0;
+}
+
+/* Returns the number of bytes at the start of a read of n bytes to
+ * dump: the remaining bytes are skipped. */
+size_t sample_take(sample_t *sp, int64_t now, size_t n) {
+  int64_t elapsed = sp->last == -1 ? 0 : now - sp->last;
+  size_t take = 0;
+
+  sp->last = now;
+
+  switch (sp->policy) {
+  case SAMPLE_BURST:
+    if (elapsed >= sp->gap)
+      sp->count = 0;
+    take = sp->arg - sp->count;
+    if (take > n)
+      take = n;
+    sp->count += take;
+    break;
+
+  case SAMPLE_RATE:
+    /* the bucket holds at most 1 second of tokens */
+    if (elapsed > 1000)
+      elapsed = 1000;
+    sp->tokens += sp->arg * (size_t)elapsed;
+    if (sp->tokens > sp->arg * 1000)
+      sp->tokens = sp->arg * 1000;
+    take = sp->tokens / 1000 < n ? sp->tokens / 1000 : n;
+    sp->tokens -= take * 1000;
+    break;
+
+  case SAMPLE_CHUNK:
+    take = sp->count++ % sp->arg == 0 ? n : 0;
+    break;
+
+  default:
+    take = n;
+    break;
+  }
+
+  return take;
+}
+
+static int sample_arg(const char *s, char **endp, size_t *arg) {
+  if (*s < '0' || *s > '9') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  errno = 0;
+  *arg = (size_t)strtoul(s, endp, 10);
+
+  return errno == 0 ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* sampling policy */
+enum {
+  SAMPLE_NONE = 0,
+  SAMPLE_BURST = 1, /* burst:<bytes>[:<gap ms>]: start of each burst */
+  SAMPLE_RATE = 2,  /* rate:<bytes/s>: token bucket */
+  SAMPLE_CHUNK = 3, /* chunk:<k>: 1 in k reads */
+};
+
+typedef struct {
+  int policy;
+  size_t arg;
+  int64_t gap;    /* burst: idle time ending a burst (ms) */
+  size_t count;   /* burst: bytes dumped in the burst, chunk: reads */
+  size_t tokens;  /* rate: bytes available (1/1000 bytes) */
+  int64_t last;   /* time of the previous read (ms) */
+} sample_t;
+
+int sample_init(sample_t *sp, const char *spec);
+size_t sample_take(sample_t *sp, int64_t now, size_t n);
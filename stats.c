@@ -0,0 +1,166 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+#include "stats.h"
+
+static unsigned int bucket(uint64_t v);
+static int histogram(FILE *fp, const uint64_t hist[64]);
+
+/* Returns the monotonic time in nanoseconds. */
+uint64_t stats_now(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    return 0;
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the log2 bucket of a value: bucket n holds [2^n, 2^(n+1)). */
+static unsigned int bucket(uint64_t v) {
+  unsigned int n = 0;
+
+  while (v >>= 1)
+    n++;
+
+  return n;
+}
+
+/* Returns the start time of a timed call, or 0 if the call is not timed:
+ * 1 in STATS_SAMPLE calls is timed. */
+uint64_t stats_sample(uint64_t *calls) {
+  return (*calls)++ % STATS_SAMPLE == 0 ? stats_now() : 0;
+}
+
+void stats_latency(stats_t *st, uint64_t ns) { st->latency[bucket(ns)]++; }
+
+/* Count n bytes formatted. If the record is timed (see stats_sample()),
+ * count the time since start. */
+void stats_format(stats_t *st, size_t n, uint64_t start) {
+  atomic_fetch_add_explicit(&st->formatted, n, memory_order_relaxed);
+  if (start == 0)
+    return;
+  atomic_fetch_add_explicit(&st->format_ns,
+                            (stats_now() - start) * STATS_SAMPLE,
+                            memory_order_relaxed);
+}
+
+/* Write the counters as a line of name=value pairs. The latency
+ * histogram lists the non-empty buckets as <lower bound (ns)>:<count>. */
+int stats_write(FILE *fp, const char *name, stats_t *st) {
+  if (fprintf(fp,
+              "%s bytes=%" PRIu64 " reads=%" PRIu64 " writes=%" PRIu64
+              " splices=%" PRIu64 " short_writes=%" PRIu64 " eintr=%" PRIu64
+              " formatted=%" PRIu64 " relay_ns=%" PRIu64 " dump_ns=%" PRIu64
+              " format_ns=%" PRIu64 " latency_ns=",
+              name, st->bytes, st->reads, st->writes, st->splices,
+              st->short_writes, st->eintr,
+              (uint64_t)atomic_load_explicit(&st->formatted,
+                                             memory_order_relaxed),
+              st->relay_ns, st->dump_ns,
+              (uint64_t)atomic_load_explicit(&st->format_ns,
+                                             memory_order_relaxed)) < 0)
+    return -1;
+
+  if (histogram(fp, st->latency) < 0 || fprintf(fp, "\n") < 0)
+    return -1;
+
+  return fflush(fp) == EOF ? -1 : 0;
+}
+
+/* Count a read of n bytes. The byte values are counted in 4 tables: a
+ * run of the same value does not serialize on a single counter. */
+void stats_traffic(traffic_t *t, const void *data, size_t n) {
+  const unsigned char *p = data;
+  size_t i;
+
+  t->bytes += n;
+  t->chunks++;
+  t->sizes[bucket(n)]++;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    t->count[0][p[i]]++;
+    t->count[1][p[i + 1]]++;
+    t->count[2][p[i + 2]]++;
+    t->count[3][p[i + 3]]++;
+  }
+
+  for (; i < n; i++)
+    t->count[0][p[i]]++;
+}
+
+/* Write the traffic analysis as a line of name=value pairs:
+ *
+ * rate: bytes per second since the last report
+ * entropy: Shannon entropy of the byte values (bits per byte)
+ * printable: fraction of printable ASCII bytes
+ * sizes: read size histogram */
+int stats_report(FILE *fp, const char *name, traffic_t *t) {
+  uint64_t now = stats_now();
+  double entropy = 0;
+  double printable = 0;
+  double p;
+  uint64_t c;
+  size_t i;
+
+  for (i = 0; i < 256 && t->bytes > 0; i++) {
+    c = t->count[0][i] + t->count[1][i] + t->count[2][i] + t->count[3][i];
+    if (c == 0)
+      continue;
+    p = (double)c / (double)t->bytes;
+    entropy -= p * log2(p);
+    if (i >= ' ' && i <= '~')
+      printable += p;
+  }
+
+  if (fprintf(fp,
+              "%s traffic bytes=%" PRIu64 " chunks=%" PRIu64
+              " rate=%.0f entropy=%.3f printable=%.3f sizes=",
+              name, t->bytes, t->chunks,
+              now > t->mark_ns ? (double)(t->bytes - t->mark) * 1e9 /
+                                     (double)(now - t->mark_ns)
+                               : 0,
+              entropy, printable) < 0)
+    return -1;
+
+  t->mark = t->bytes;
+  t->mark_ns = now;
+
+  if (histogram(fp, t->sizes) < 0 || fprintf(fp, "\n") < 0)
+    return -1;
+
+  return fflush(fp) == EOF ? -1 : 0;
+}
+
+/* Write the non-empty buckets of a log2 histogram as
+ * <lower bound>:<count>. */
+static int histogram(FILE *fp, const uint64_t hist[64]) {
+  const char *sep = "";
+  size_t i;
+
+  for (i = 0; i < 64; i++) {
+    if (hist[i] == 0)
+      continue;
+    if (fprintf(fp, "%s%" PRIu64 ":%" PRIu64, sep, (uint64_t)1 << i,
+                hist[i]) < 0)
+      return -1;
+    sep = ",";
+  }
+
+  return 0;
+}
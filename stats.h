@@ -0,0 +1,61 @@
+/* Copyright (c) 2020-2024, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* HEXLOG_STATS: 1 in STATS_SAMPLE relay calls and formatted records is
+ * timed: the intervals are scaled by STATS_SAMPLE, the latency histogram
+ * holds the timed calls */
+#define STATS_SAMPLE 64
+
+/* HEXLOG_STATS: counters for a stream
+ *
+ * The relay fields are updated by the event loop. The format fields are
+ * updated by the thread formatting the dump. */
+typedef struct {
+  uint64_t bytes;        /* bytes forwarded to the destination */
+  uint64_t reads;        /* read(2) calls */
+  uint64_t writes;       /* write(2) calls */
+  uint64_t splices;      /* splice(2) calls forwarding data */
+  uint64_t short_writes; /* writes accepting part of the data */
+  uint64_t eintr;        /* calls interrupted by a signal */
+  uint64_t relay_ns;     /* reading and forwarding */
+  uint64_t dump_ns;      /* relay: matching, sampling and dumping */
+  uint64_t pending;      /* time the oldest unforwarded data was read */
+  uint64_t latency[64];  /* read to forward: log2(ns) buckets */
+  uint64_t relays;       /* relay calls: selects the timed calls */
+  uint64_t records;      /* formatted records: selects the timed records */
+  atomic_uint_fast64_t formatted; /* bytes formatted for the dump */
+  atomic_uint_fast64_t format_ns;
+} stats_t;
+
+/* stats mode: traffic analysis of a stream */
+typedef struct {
+  uint64_t bytes;
+  uint64_t chunks;        /* reads returning data */
+  uint64_t sizes[64];     /* read sizes: log2 buckets */
+  uint64_t count[4][256]; /* byte values: interleaved tables */
+  uint64_t mark;          /* bytes at the last report */
+  uint64_t mark_ns;       /* time of the last report */
+} traffic_t;
+
+uint64_t stats_now(void);
+uint64_t stats_sample(uint64_t *calls);
+void stats_latency(stats_t *st, uint64_t ns);
+void stats_format(stats_t *st, size_t n, uint64_t start);
+int stats_write(FILE *fp, const char *name, stats_t *st);
+void stats_traffic(traffic_t *t, const void *data, size_t n);
+int stats_report(FILE *fp, const char *name, traffic_t *t);
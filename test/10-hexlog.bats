@@ -79,3 +79,406 @@ EOF
     run sh -c "hexlog inout echo test >/dev/null </dev/null"
     [ "$status" -eq 0 ]
 }
+
+@test "stdin: inout: formatter thread" {
+    TEST="abc123"
+    HEXLOG_THREAD=1 run hexlog inout cat -n <<<"$TEST"
+    expect='     1	abc123
+61 62 63 31 32 33 0A                              |abc123.| (0)
+20 20 20 20 20 31 09 61  62 63 31 32 33 0A        |     1.abc123.| (1)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "stdin: in: idle timeout" {
+    run sh -c "(printf abc; sleep 1; printf def) | HEXLOG_TIMEOUT_MS=100 hexlog in cat >/dev/null"
+    expect='61 62 63                                          |abc| (0)
+64 65 66                                          |def| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "stdin: in: destination not reading" {
+    dir="$(mktemp -d)"
+    run bash -c "head -c 1000000 /dev/zero | timeout 10 hexlog in sh -c 'dd bs=4096 count=1 of=/dev/null 2>/dev/null; echo ready; while [ ! -e $dir/seen ]; do sleep 0.1; done; wc -c' 2>/dev/null | while read -r line; do echo \$line; touch $dir/seen; done"
+    expect='ready
+995904'
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "overflow: slow dump output" {
+    dir="$(mktemp -d)"
+    head -c 200000 /dev/urandom > "$dir/in"
+    run bash -c "for p in block drop-newest drop-oldest; do
+        HEXLOG_OVERFLOW=\$p HEXLOG_QUEUE_SIZE=4096 hexlog in cat <$dir/in 2>&1 >$dir/out | (sleep 1; cat > $dir/dump)
+        cmp -s $dir/in $dir/out && printf '%s exact ' \$p
+        grep -q 'bytes skipped (0)' $dir/dump && echo skipped || wc -l < $dir/dump
+    done"
+    expect='block exact 12500
+drop-newest exact skipped
+drop-oldest exact skipped'
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "decode: capture" {
+    run sh -c "echo abc123 | HEXLOG_FORMAT_STDIN=capture HEXLOG_FORMAT_STDOUT=capture hexlog inout cat -n 2>&1 >/dev/null | hexlog decode"
+    expect='61 62 63 31 32 33 0A                              |abc123.| (0)
+20 20 20 20 20 31 09 61  62 63 31 32 33 0A        |     1.abc123.| (1)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "decode: capture: mixed formats rejected" {
+    run sh -c "echo abc123 | HEXLOG_FORMAT_STDIN=capture hexlog inout cat -n 2>&1 >/dev/null"
+    expect='hexlog: HEXLOG_FORMAT_STDIN: capture output shared with another format'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 2 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "compress: hex" {
+    HEXLOG_COMPRESS=1 hexlog in true </dev/null 2>/dev/null ||
+        skip "built without zlib"
+    run sh -c "echo abc123 | HEXLOG_COMPRESS=6 hexlog inout cat -n 2>&1 >/dev/null | gzip -dc"
+    expect='61 62 63 31 32 33 0A                              |abc123.| (0)
+20 20 20 20 20 31 09 61  62 63 31 32 33 0A        |     1.abc123.| (1)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "compress: no dump: empty output" {
+    HEXLOG_COMPRESS=1 hexlog in true </dev/null 2>/dev/null ||
+        skip "built without zlib"
+    run sh -c "echo abc123 | HEXLOG_COMPRESS=6 hexlog none cat 2>&1"
+    expect='abc123'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "file: rotate" {
+    dir="$(mktemp -d)"
+    run sh -c "printf '%s\n' abc123 def456 | HEXLOG_DIR=$dir HEXLOG_FILE_STDOUT=dump HEXLOG_ROTATE_SIZE=1 HEXLOG_TIMEOUT_MS=10 hexlog out sh -c 'read a; echo \$a; sleep 1; read b; echo \$b' >/dev/null && cat $dir/dump.*"
+    expect='61 62 63 31 32 33 0A                              |abc123.| (1)
+64 65 66 34 35 36 0A                              |def456.| (1)'
+    nfile=$(ls "$dir" | wc -l)
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+    [ "$nfile" -eq 2 ]
+}
+
+@test "ring: dump on abnormal exit" {
+    run sh -c "printf '%s\n' abc123 def456 | HEXLOG_RING_SIZE=1 hexlog in sh -c 'cat; exit 3' 2>&1 >/dev/null"
+    expect='61 62 63 31 32 33 0A 64  65 66 34 35 36 0A        |abc123.def456.| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 3 ]
+    [ "$output" = "$expect" ]
+
+    run sh -c "echo abc123 | HEXLOG_RING_SIZE=1 hexlog in cat 2>&1 >/dev/null"
+    [ "$status" -eq 0 ]
+    [ "$output" = "" ]
+}
+
+@test "trigger: start and end patterns" {
+    run sh -c "printf 'abc123 ERROR: def456\nghi789\n' | HEXLOG_TRIGGER='ERROR' HEXLOG_TRIGGER_END='\n' HEXLOG_TRIGGER_LOOKBACK=4 hexlog in cat 2>&1 >/dev/null"
+    expect='31 32 33 20 45 52 52 4F  52 3A 20 64 65 66 34 35  |123 ERROR: def45| (0)
+36 0A                                             |6.| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "sample: burst" {
+    run sh -c "printf 'abc123def456\n' | HEXLOG_SAMPLE_STDIN=burst:6 hexlog in cat 2>&1 >/dev/null"
+    expect='61 62 63 31 32 33                                 |abc123| (0)
+7 bytes skipped (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "stdin: in: buffer size" {
+    run sh -c "echo abc123def456ghi789 | HEXLOG_BUFSIZE=16 hexlog in cat 2>&1 >/dev/null"
+    expect='61 62 63 31 32 33 64 65  66 34 35 36 67 68 69 37  |abc123def456ghi7| (0)
+38 39 0A                                          |89.| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "stats: counters written at exit" {
+    run sh -c "echo abc | HEXLOG_STATS=3 hexlog in cat 3>&1 >/dev/null 2>/dev/null | sed 's/ reads=.* formatted=/ formatted=/; s/ relay_ns=.*//'"
+    expect='stdin bytes=4 formatted=4
+stdout bytes=4 formatted=0'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "stats: traffic analysis" {
+    run sh -c "printf 'aaaabbbb' | hexlog stats cat 2>&1 >/dev/null | sed 's/ rate=[0-9]*//'"
+    expect='stdin traffic bytes=8 chunks=1 entropy=1.000 printable=1.000 sizes=8:1
+stdout traffic bytes=8 chunks=1 entropy=1.000 printable=1.000 sizes=8:1'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "digest: crc32c of streams and messages" {
+    run sh -c "printf 'hello\nworld\nxyz' | HEXLOG_DIGEST=crc32c HEXLOG_DIGEST_MESSAGE='\n' hexlog none cat 2>&1 >/dev/null | grep ^stdin"
+    expect='stdin message=1 bytes=6 crc32c=353dd8be
+stdin message=2 bytes=6 crc32c=d4ad7373
+stdin message=3 bytes=3 crc32c=25236885
+stdin digest bytes=15 crc32c=6fb537f5 eof'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "squeeze: identical lines" {
+    run sh -c "printf 'AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAxyz' | HEXLOG_SQUEEZE=1 hexlog in cat 2>&1 >/dev/null"
+    expect='00000000  41 41 41 41 41 41 41 41  41 41 41 41 41 41 41 41  |AAAAAAAAAAAAAAAA| (0)
+* (0)
+00000030  78 79 7A                                          |xyz| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "fds: stderr and an input fd" {
+    run sh -c "echo abc | HEXLOG_FDS=2,3:in HEXLOG_LABEL_3=' (fd3)' hexlog inout sh -c 'cat >&2; cat <&3' 3<<EOF 2>&1 >/dev/null | sort
+xyz
+EOF"
+    expect='61 62 63 0A                                       |abc.| (0)
+61 62 63 0A                                       |abc.| (2)
+78 79 7A 0A                                       |xyz.| (1)
+78 79 7A 0A                                       |xyz.| (fd3)
+abc'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "relay threads: inout" {
+    run sh -c "echo abc | HEXLOG_RELAY_THREADS=1 hexlog inout cat -n 2>&1 >/dev/null | sort"
+    expect='20 20 20 20 20 31 09 61  62 63 0A                 |     1.abc.| (1)
+61 62 63 0A                                       |abc.| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "format workers: large records" {
+    dir="$(mktemp -d)"
+    seq 1 30000 > "$dir/in"
+    expect="$(HEXLOG_BUFSIZE=262144 hexlog in cat < "$dir/in" 2>&1 >/dev/null)"
+    run sh -c "HEXLOG_FORMAT_WORKERS=3 HEXLOG_BUFSIZE=262144 hexlog in cat < $dir/in 2>&1 >/dev/null"
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "output: delay: written on exit" {
+    run sh -c "printf '%s\n' abc123 def456 | HEXLOG_OUTPUT_DELAY=60000 hexlog in cat 2>&1 >/dev/null"
+    expect='61 62 63 31 32 33 0A 64  65 66 34 35 36 0A        |abc123.def456.| (0)'
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "sinks: raw and hex outputs" {
+    dir="$(mktemp -d)"
+    run sh -c "printf '%s\n' abc123 def456 | HEXLOG_SINKS_STDIN=raw:$dir/raw,hex:3 hexlog in cat 2>/dev/null 3>$dir/hex >/dev/null && cat $dir/raw $dir/hex"
+    expect='abc123
+def456
+61 62 63 31 32 33 0A 64  65 66 34 35 36 0A        |abc123.def456.| (0)'
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}
+
+@test "sinks: file output: rlimit process restrictions" {
+    dir="$(mktemp -d)"
+    make -s -C "$BATS_TEST_DIRNAME/.." RESTRICT_PROCESS=rlimit PROG="$dir/hexlog" >/dev/null
+    run sh -c "echo abc123 | HEXLOG_SINKS_STDIN=raw:$dir/raw $dir/hexlog in cat 2>/dev/null >/dev/null && cat $dir/raw"
+    expect='abc123'
+    rm -rf "$dir"
+    cat << EOF
+--- output
+$output
+===
+$expect
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expect" ]
+}